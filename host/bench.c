@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mdns/mdns.h>
+
+#include "host_platform.h"
+#include "corpus.h"
+#include "bench_publish.h"
+
+#include "mdns_network.h"
+#include "mdns_publish.h"
+#include "mdns_query.h"
+#include "server.h"
+
+//
+// Benchmarks of the response serializer and the packet parsers, run on the host
+// against the stub platform. Usage: bench [-j] [-n iterations] [-s segment] [filter]
+//
+
+// service counts of the handles the benchmarks run against
+static const uint8_t serviceCounts[] = { 1, 8, 64 };
+
+// options
+static bool jsonOutput;
+static uint32_t iterations = 20000;
+static uint16_t segmentLen;
+static const char *filter;
+
+// a benchmark operation, returns the bytes it produced apart from sent packets
+typedef uint32_t (benchOperation)(void *context);
+
+typedef struct _benchContext {
+    mdnsHandle *handle;
+    const corpusPacket *packet;
+    mdnsRecordType query;
+    mdnsService *serviceOrNull;
+} benchContext;
+
+static const ip_address_t hostIP = { .addr8 = { 192, 168, 1, 10 } };
+static const ip6_address_t hostIP6 = { { 0x000080fe, 0, 0xff0e7c02, 0x0a00fefe } };
+static ip_addr_t querierIP = { 0x0b01a8c0 };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t ns, uint64_t allocations, uint64_t allocatedBytes, uint64_t outputBytes) {
+    double n = iterations;
+
+    if (jsonOutput) {
+        printf("{\"name\": \"%s\", \"iterations\": %u, \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f, \"output_bytes_per_op\": %.1f}\n",
+            name, iterations, ns / n, allocations / n, allocatedBytes / n, outputBytes / n);
+    } else {
+        printf("%-52s %8u %10.1f ns/op %8.3f allocs/op %9.1f B/op %9.1f out/op\n",
+            name, iterations, ns / n, allocations / n, allocatedBytes / n, outputBytes / n);
+    }
+}
+
+// run an operation for all iterations, the simulated clock moves on between them
+// so rate limits and record TTLs behave like on a network with steady traffic
+static void run(const char *name, benchOperation *operation, void *context) {
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+
+    // warm up caches, the first call fills the response cache
+    host_set_time(host_time() + 1100);
+    operation(context);
+
+    host_reset_sent();
+    hostHeapStats heap = host_heap;
+    uint64_t outputBytes = 0;
+
+    uint64_t start = now_ns();
+    for (uint32_t i = 0; i < iterations; i++) {
+        host_set_time(host_time() + 1100);
+        outputBytes += operation(context);
+    }
+    uint64_t ns = now_ns() - start;
+
+    report(name, ns, host_heap.allocations - heap.allocations, host_heap.allocatedBytes - heap.allocatedBytes, outputBytes + host_sent.bytes);
+}
+
+//
+// operations
+//
+
+static uint32_t prepare_response(void *context) {
+    benchContext *bench = context;
+    static char buffer[MDNS_MAX_PACKET_SIZE];
+    uint8_t numPackets;
+
+    return bench_prepare_response(bench->handle, buffer, bench->query, bench->serviceOrNull, &numPackets);
+}
+
+// stream over the packet, positioned behind the header
+static void open_packet(benchContext *bench, hostPacket *chain, mdnsStreamBuf *stream) {
+    mdns_stream_init(stream, host_packet_chain(chain, bench->packet->data, bench->packet->len, segmentLen));
+    mdns_stream_skip(stream, 12);
+}
+
+static uint16_t header_field(const corpusPacket *packet, uint8_t index) {
+    return (packet->data[index * 2] << 8) | packet->data[index * 2 + 1];
+}
+
+static void run_parse_query(benchContext *bench) {
+    hostPacket chain;
+    mdnsStreamBuf stream;
+
+    open_packet(bench, &chain, &stream);
+    bool truncated = (header_field(bench->packet, 1) & 0x0200) != 0;
+    mdns_parse_query(bench->handle, &stream, header_field(bench->packet, 2), header_field(bench->packet, 3), header_field(bench->packet, 0), truncated, &querierIP, bench->packet->port);
+}
+
+// parsing only, answers that wait for their random delay are never sent
+static uint32_t parse_query(void *context) {
+    benchContext *bench = context;
+
+    run_parse_query(bench);
+
+    // the delayed responses would pile up otherwise
+    mdns_cancel_pending_response(bench->handle);
+    return 0;
+}
+
+// parse and answer, the delayed response is sent like when its event is due
+static uint32_t respond_query(void *context) {
+    benchContext *bench = context;
+
+    run_parse_query(bench);
+
+    mdns_unschedule(&bench->handle->scheduler, mdnsEventTypeResponse, NULL);
+    mdns_send_pending_response(bench->handle);
+    return 0;
+}
+
+static uint32_t parse_answers(void *context) {
+    benchContext *bench = context;
+    hostPacket chain;
+    mdnsStreamBuf stream;
+
+    open_packet(bench, &chain, &stream);
+    mdns_parse_answers(bench->handle, &stream, header_field(bench->packet, 3) + header_field(bench->packet, 5));
+    return 0;
+}
+
+static uint32_t parse_packet(void *context) {
+    benchContext *bench = context;
+    hostPacket chain;
+    mdnsStreamBuf stream;
+
+    mdns_stream_init(&stream, host_packet_chain(&chain, bench->packet->data, bench->packet->len, segmentLen));
+    mdns_parse_packet(bench->handle, &stream, &querierIP, bench->packet->port);
+
+    // parsing only, like parse_query
+    mdns_cancel_pending_response(bench->handle);
+    return 0;
+}
+
+//
+// setup
+//
+
+static void *found_service(mdnsService *service) {
+    return NULL;
+}
+
+static mdnsHandle *create_handle(uint8_t numServices) {
+    mdnsHandle *handle = mdns_create(CORPUS_HOSTNAME);
+    mdns_update_ip(handle, hostIP, hostIP6);
+
+    for (uint8_t i = 0; i < numServices; i++) {
+        char name[16];
+        if (i == 0) {
+            strcpy(name, CORPUS_SERVICE);
+        } else {
+            sprintf(name, "_svc%02d", i);
+        }
+
+        mdnsService *service = mdns_create_service(name, (i % 4 == 3) ? mdnsProtocolUDP : mdnsProtocolTCP, CORPUS_SERVICE_PORT + i);
+        mdns_service_add_txt(service, "path", "/");
+        mdns_service_add_txt(service, "version", "2");
+        mdns_add_service(handle, service);
+    }
+
+    mdns_query(handle, CORPUS_QUERY_CHROMECAST, mdnsProtocolTCP, found_service);
+    mdns_query(handle, CORPUS_QUERY_PRINTER, mdnsProtocolTCP, found_service);
+
+    return handle;
+}
+
+// the response for all services has to grow with them, or the benchmarks do not measure what they claim
+static void check_scaling(mdnsHandle *handle, uint8_t numServices) {
+    static uint32_t lastBytes;
+    static char buffer[MDNS_MAX_PACKET_SIZE];
+    uint8_t numPackets;
+
+    uint32_t bytes = bench_prepare_response(handle, buffer, mdnsRecordTypePTR, NULL, &numPackets);
+    if (bytes <= lastBytes) {
+        fprintf(stderr, "bench: response for %d services has %u bytes, not more than for fewer services (%u)\n", numServices, bytes, lastBytes);
+        exit(1);
+    }
+    lastBytes = bytes;
+}
+
+static void bench_handle(uint8_t numServices) {
+    // a host has one instance of every service type, so the answers to PTR, SRV and TXT
+    // queries are one service whatever the count. The _all responses cover every service.
+    static const struct {
+        const char *name;
+        mdnsRecordType query;
+        bool allServices;
+    } responses[] = {
+        { "PTR", mdnsRecordTypePTR, false },
+        { "SRV", mdnsRecordTypeSRV, false },
+        { "TXT", mdnsRecordTypeTXT, false },
+        { "SRV_all", mdnsRecordTypeSRV, true },
+        { "TXT_all", mdnsRecordTypeTXT, true },
+        { "A", mdnsRecordTypeA, true },
+        { "AAAA", mdnsRecordTypeAAAA, true },
+        { "announce", mdnsRecordTypePTR, true }
+    };
+
+    mdnsHandle *handle = create_handle(numServices);
+    benchContext bench = { handle, NULL, 0, NULL };
+    char name[96];
+
+    check_scaling(handle, numServices);
+
+    for (uint8_t i = 0; i < sizeof(responses) / sizeof(responses[0]); i++) {
+        bench.query = responses[i].query;
+        bench.serviceOrNull = responses[i].allServices ? NULL : handle->services[0];
+        snprintf(name, sizeof(name), "prepare_response/%s/%d", responses[i].name, numServices);
+        run(name, prepare_response, &bench);
+    }
+
+    uint8_t numPackets;
+    const corpusPacket *corpus = corpus_packets(&numPackets);
+    for (uint8_t i = 0; i < numPackets; i++) {
+        bench.packet = &corpus[i];
+        if (corpus[i].response) {
+            snprintf(name, sizeof(name), "parse_answers/%s/%d", corpus[i].name, numServices);
+            run(name, parse_answers, &bench);
+        } else {
+            snprintf(name, sizeof(name), "parse_query/%s/%d", corpus[i].name, numServices);
+            run(name, parse_query, &bench);
+            snprintf(name, sizeof(name), "respond_query/%s/%d", corpus[i].name, numServices);
+            run(name, respond_query, &bench);
+        }
+    }
+
+    for (uint8_t i = 0; i < numPackets; i++) {
+        bench.packet = &corpus[i];
+        snprintf(name, sizeof(name), "parse_packet/%s/%d", corpus[i].name, numServices);
+        run(name, parse_packet, &bench);
+    }
+
+    mdns_destroy(handle);
+}
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "jn:s:")) != -1) {
+        switch (option) {
+            case 'j':
+                jsonOutput = true;
+                break;
+            case 'n':
+                iterations = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                segmentLen = strtoul(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-n iterations] [-s segment] [filter]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        filter = argv[optind];
+    }
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    // the clock starts at some time after boot, zero means never multicast
+    host_set_time(10000);
+
+    for (uint8_t i = 0; i < sizeof(serviceCounts); i++) {
+        bench_handle(serviceCounts[i]);
+    }
+
+    return 0;
+}
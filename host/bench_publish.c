@@ -0,0 +1,24 @@
+// The response serializer is private to mdns_publish.c, so the benchmark
+// compiles it into this file and wraps it. mdns_publish.c is not linked separately.
+#include "../library/mdns_publish.c"
+
+#include "bench_publish.h"
+
+// serialize the whole response cascade of a query type like send_mdns_response_packet does,
+// without the response cache. Returns the number of bytes of all packets.
+uint32_t bench_prepare_response(mdnsHandle *handle, char *buffer, mdnsRecordType query, mdnsService *serviceOrNull, uint8_t *numPackets) {
+    mdnsCascade cascade = { record_bit(query), 0, false };
+    uint32_t bytes = 0;
+
+    *numPackets = 0;
+    while (cascade.record & MDNS_RECORDS_ALL) {
+        uint16_t len = mdns_prepare_response(handle, buffer, MDNS_MAX_PACKET_SIZE, record_bit(query), MDNS_RECORDS_ALL, MDNS_MULTICAST_TTL, 0, serviceOrNull, &cascade);
+        if (len == 0) {
+            break;
+        }
+        bytes += len;
+        (*numPackets)++;
+    }
+
+    return bytes;
+}
@@ -0,0 +1,13 @@
+#ifndef mdns_host_bench_publish_h_included
+#define mdns_host_bench_publish_h_included
+
+#include <stdint.h>
+
+#include <mdns/mdns.h>
+#include "dns.h"
+
+// serialize the response to a query of type query into buffer (MDNS_MAX_PACKET_SIZE bytes),
+// for all services if serviceOrNull is NULL. Returns the bytes of all packets of the response.
+uint32_t bench_prepare_response(mdnsHandle *handle, char *buffer, mdnsRecordType query, mdnsService *serviceOrNull, uint8_t *numPackets);
+
+#endif /* mdns_host_bench_publish_h_included */
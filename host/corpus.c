@@ -0,0 +1,318 @@
+#include <string.h>
+
+#include "corpus.h"
+
+//
+// private
+//
+
+#define CLASS_IN 0x0001
+#define CLASS_QU 0x8000    // unicast response bit of a question
+#define CLASS_FLUSH 0x8000 // cache flush bit of a record
+
+#define TYPE_A 1
+#define TYPE_PTR 12
+#define TYPE_TXT 16
+#define TYPE_AAAA 28
+#define TYPE_SRV 33
+#define TYPE_ANY 255
+
+#define FLAGS_QUERY 0x0000
+#define FLAGS_RESPONSE 0x8400 // response, authoritative
+
+// the corpus is built once, the benchmarks only read it
+#define CORPUS_MAX_PACKETS 16
+
+static corpusPacket corpus[CORPUS_MAX_PACKETS];
+static uint8_t corpusLen;
+
+static void put8(corpusPacket *packet, uint8_t value) {
+    packet->data[packet->len++] = value;
+}
+
+static void put16(corpusPacket *packet, uint16_t value) {
+    put8(packet, value >> 8);
+    put8(packet, value & 0xff);
+}
+
+static void put32(corpusPacket *packet, uint32_t value) {
+    put16(packet, value >> 16);
+    put16(packet, value & 0xffff);
+}
+
+static void put_bytes(corpusPacket *packet, const void *data, uint16_t len) {
+    memcpy(packet->data + packet->len, data, len);
+    packet->len += len;
+}
+
+// write the labels of a dotted name, followed by a compression pointer to an earlier
+// name if pointer is not zero or the root label. Returns the offset of the name.
+// The "local" label of a service type name starts at sizeof(type) + 5 from the name.
+static uint16_t put_name(corpusPacket *packet, const char *name, uint16_t pointer) {
+    uint16_t offset = packet->len;
+
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        uint8_t len = dot ? dot - name : strlen(name);
+        put8(packet, len);
+        put_bytes(packet, name, len);
+        name += len + (dot ? 1 : 0);
+    }
+
+    if (pointer) {
+        put16(packet, 0xc000 | pointer);
+    } else {
+        put8(packet, 0);
+    }
+
+    return offset;
+}
+
+static corpusPacket *begin(const char *name, uint16_t flags, uint16_t numQuestions, uint16_t numAnswers, uint16_t numAdditionals) {
+    corpusPacket *packet = &corpus[corpusLen++];
+    memset(packet, 0, sizeof(corpusPacket));
+    packet->name = name;
+    packet->port = MDNS_PORT;
+    packet->response = (flags & 0x8000) != 0;
+
+    put16(packet, 0); // transaction ID
+    put16(packet, flags);
+    put16(packet, numQuestions);
+    put16(packet, numAnswers);
+    put16(packet, 0); // authority
+    put16(packet, numAdditionals);
+
+    return packet;
+}
+
+static uint16_t question(corpusPacket *packet, const char *name, uint16_t pointer, uint16_t type, uint16_t class) {
+    uint16_t offset = put_name(packet, name, pointer);
+    put16(packet, type);
+    put16(packet, class);
+    return offset;
+}
+
+// start a record, returns the offset of its data length which end_record fills in
+static uint16_t record(corpusPacket *packet, const char *name, uint16_t pointer, uint16_t type, uint16_t class, uint32_t ttl, uint16_t *nameOffset) {
+    uint16_t offset = put_name(packet, name, pointer);
+    if (nameOffset) {
+        *nameOffset = offset;
+    }
+    put16(packet, type);
+    put16(packet, class);
+    put32(packet, ttl);
+    put16(packet, 0);
+    return packet->len - 2;
+}
+
+static void end_record(corpusPacket *packet, uint16_t lengthOffset) {
+    uint16_t len = packet->len - lengthOffset - 2;
+    packet->data[lengthOffset] = len >> 8;
+    packet->data[lengthOffset + 1] = len & 0xff;
+}
+
+static void put_txt(corpusPacket *packet, const char **strings) {
+    while (*strings) {
+        uint8_t len = strlen(*strings);
+        put8(packet, len);
+        put_bytes(packet, *strings, len);
+        strings++;
+    }
+}
+
+static void put_srv(corpusPacket *packet, uint16_t port, const char *target, uint16_t pointer) {
+    put16(packet, 0); // priority
+    put16(packet, 0); // weight
+    put16(packet, port);
+    put_name(packet, target, pointer);
+}
+
+//
+// packets
+//
+
+// browsing for our service type
+static void query_ptr(void) {
+    corpusPacket *packet = begin("query_ptr", FLAGS_QUERY, 1, 0, 0);
+    question(packet, CORPUS_SERVICE "._tcp.local", 0, TYPE_PTR, CLASS_IN);
+}
+
+// browsing again, the querier knows our instance already
+static void query_ptr_known_answer(void) {
+    corpusPacket *packet = begin("query_ptr_known_answer", FLAGS_QUERY, 1, 1, 0);
+    uint16_t type = question(packet, CORPUS_SERVICE "._tcp.local", 0, TYPE_PTR, CLASS_IN);
+    uint16_t len = record(packet, "", type, TYPE_PTR, CLASS_IN, 4500, NULL);
+    put_name(packet, CORPUS_HOSTNAME, type);
+    end_record(packet, len);
+}
+
+// resolving the hostname
+static void query_host(void) {
+    corpusPacket *packet = begin("query_host", FLAGS_QUERY, 2, 0, 0);
+    uint16_t host = question(packet, CORPUS_HOSTNAME ".local", 0, TYPE_A, CLASS_IN);
+    question(packet, "", host, TYPE_AAAA, CLASS_IN);
+}
+
+// everything about our instance
+static void query_any_instance(void) {
+    corpusPacket *packet = begin("query_any_instance", FLAGS_QUERY, 1, 0, 0);
+    question(packet, CORPUS_HOSTNAME "." CORPUS_SERVICE "._tcp.local", 0, TYPE_ANY, CLASS_IN);
+}
+
+// resolving our instance, asking for unicast responses
+static void query_qu_instance(void) {
+    corpusPacket *packet = begin("query_qu_instance", FLAGS_QUERY, 2, 0, 0);
+    uint16_t instance = question(packet, CORPUS_HOSTNAME "." CORPUS_SERVICE "._tcp.local", 0, TYPE_SRV, CLASS_IN | CLASS_QU);
+    question(packet, "", instance, TYPE_TXT, CLASS_IN | CLASS_QU);
+}
+
+// a phone browsing for a handful of service types with the instances it knows
+static void query_phone_browse(void) {
+    corpusPacket *packet = begin("query_phone_browse", FLAGS_QUERY, 6, 3, 0);
+    uint16_t airplay = question(packet, "_airplay._tcp.local", 0, TYPE_PTR, CLASS_IN | CLASS_QU);
+    uint16_t tcp = airplay + 9;
+    uint16_t local = tcp + 5;
+    uint16_t raop = question(packet, "_raop", tcp, TYPE_PTR, CLASS_IN | CLASS_QU);
+    uint16_t companion = question(packet, "_companion-link", tcp, TYPE_PTR, CLASS_IN | CLASS_QU);
+    question(packet, "_sleep-proxy._udp", local, TYPE_PTR, CLASS_IN | CLASS_QU);
+    question(packet, CORPUS_SERVICE, tcp, TYPE_PTR, CLASS_IN | CLASS_QU);
+    question(packet, "_services._dns-sd._udp", local, TYPE_PTR, CLASS_IN | CLASS_QU);
+
+    uint16_t len = record(packet, "", airplay, TYPE_PTR, CLASS_IN, 4500, NULL);
+    put_name(packet, "Living Room", airplay);
+    end_record(packet, len);
+
+    len = record(packet, "", raop, TYPE_PTR, CLASS_IN, 4500, NULL);
+    put_name(packet, "A1B2C3D4E5F6@Living Room", raop);
+    end_record(packet, len);
+
+    len = record(packet, "", companion, TYPE_PTR, CLASS_IN, 4500, NULL);
+    put_name(packet, "Kitchen", companion);
+    end_record(packet, len);
+}
+
+// resolving somebody else
+static void query_other_host(void) {
+    corpusPacket *packet = begin("query_other_host", FLAGS_QUERY, 2, 0, 0);
+    uint16_t host = question(packet, "office-printer.local", 0, TYPE_A, CLASS_IN);
+    question(packet, "", host, TYPE_AAAA, CLASS_IN);
+}
+
+// a simple resolver asking from its own port
+static void query_legacy(void) {
+    corpusPacket *packet = begin("query_legacy", FLAGS_QUERY, 1, 0, 0);
+    packet->data[0] = 0x4d;
+    packet->data[1] = 0x2a;
+    packet->port = 54321;
+    question(packet, CORPUS_HOSTNAME ".local", 0, TYPE_A, CLASS_IN);
+}
+
+// a media player announcing itself
+static void response_chromecast(void) {
+    static const char *txt[] = {
+        "id=0123456789abcdef0123456789abcdef", "cd=FEDCBA9876543210FEDCBA9876543210", "rm=",
+        "ve=05", "md=Chromecast", "ic=/setup/icon.png", "fn=Living Room TV", "ca=201221",
+        "st=0", "bs=FA8FCA123456", "nf=1", "rs=", NULL
+    };
+
+    corpusPacket *packet = begin("response_chromecast", FLAGS_RESPONSE, 0, 1, 3);
+    uint16_t type;
+    uint16_t len = record(packet, CORPUS_QUERY_CHROMECAST "._tcp.local", 0, TYPE_PTR, CLASS_IN, 120, &type);
+    uint16_t instance = put_name(packet, "Chromecast-0123456789abcdef0123456789abcdef", type);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_TXT, CLASS_IN | CLASS_FLUSH, 4500, NULL);
+    put_txt(packet, txt);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_SRV, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    uint16_t target = packet->len + 6;
+    put_srv(packet, 8009, "01234567-89ab-cdef-0123-456789abcdef", type + sizeof(CORPUS_QUERY_CHROMECAST) + 5);
+    end_record(packet, len);
+
+    len = record(packet, "", target, TYPE_A, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    put_bytes(packet, "\xc0\xa8\x01\x32", 4);
+    end_record(packet, len);
+}
+
+// a printer announcing itself
+static void response_printer(void) {
+    static const char *txt[] = {
+        "txtvers=1", "qtotal=1", "rp=ipp/print", "ty=Brother HL-L2350DW series",
+        "product=(Brother HL-L2350DW series)", "adminurl=http://office-printer.local./net/net/airprint.html",
+        "note=Office", "priority=25", "usb_MFG=Brother", "usb_MDL=HL-L2350DW series",
+        "pdl=application/octet-stream,image/urf,image/pwg-raster", "Color=F", "Duplex=T",
+        "URF=W8,SRGB24,CP1,IS1,MT1-3-4-5-8,OB10,PQ4,RS300,V1.4", "UUID=e3248000-80ce-11db-8000-30055c1a2b3c",
+        NULL
+    };
+
+    corpusPacket *packet = begin("response_printer", FLAGS_RESPONSE, 0, 1, 4);
+    uint16_t type;
+    uint16_t len = record(packet, CORPUS_QUERY_PRINTER "._tcp.local", 0, TYPE_PTR, CLASS_IN, 4500, &type);
+    uint16_t instance = put_name(packet, "Brother HL-L2350DW series", type);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_SRV, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    uint16_t target = packet->len + 6;
+    put_srv(packet, 631, "office-printer", type + sizeof(CORPUS_QUERY_PRINTER) + 5);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_TXT, CLASS_IN | CLASS_FLUSH, 4500, NULL);
+    put_txt(packet, txt);
+    end_record(packet, len);
+
+    len = record(packet, "", target, TYPE_A, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    put_bytes(packet, "\xc0\xa8\x01\x21", 4);
+    end_record(packet, len);
+
+    len = record(packet, "", target, TYPE_AAAA, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    put_bytes(packet, "\xfe\x80\x00\x00\x00\x00\x00\x00\x32\x05\x5c\xff\xfe\x1a\x2b\x3c", 16);
+    end_record(packet, len);
+}
+
+// another responder multicasting our records, as a proxy would
+static void response_own_records(void) {
+    static const char *txt[] = { "path=/", "version=2", NULL };
+
+    corpusPacket *packet = begin("response_own_records", FLAGS_RESPONSE, 0, 1, 3);
+    uint16_t type;
+    uint16_t len = record(packet, CORPUS_SERVICE "._tcp.local", 0, TYPE_PTR, CLASS_IN, 4500, &type);
+    uint16_t instance = put_name(packet, CORPUS_HOSTNAME, type);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_SRV, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    uint16_t host = packet->len + 6;
+    put_srv(packet, CORPUS_SERVICE_PORT, CORPUS_HOSTNAME, type + sizeof(CORPUS_SERVICE) + 5);
+    end_record(packet, len);
+
+    len = record(packet, "", instance, TYPE_TXT, CLASS_IN | CLASS_FLUSH, 4500, NULL);
+    put_txt(packet, txt);
+    end_record(packet, len);
+
+    len = record(packet, "", host, TYPE_A, CLASS_IN | CLASS_FLUSH, 120, NULL);
+    put_bytes(packet, "\xc0\xa8\x01\x0a", 4);
+    end_record(packet, len);
+}
+
+//
+// API
+//
+
+const corpusPacket *corpus_packets(uint8_t *numPackets) {
+    if (corpusLen == 0) {
+        query_ptr();
+        query_ptr_known_answer();
+        query_host();
+        query_any_instance();
+        query_qu_instance();
+        query_phone_browse();
+        query_other_host();
+        query_legacy();
+        response_chromecast();
+        response_printer();
+        response_own_records();
+    }
+
+    *numPackets = corpusLen;
+    return corpus;
+}
@@ -0,0 +1,37 @@
+#ifndef mdns_host_corpus_h_included
+#define mdns_host_corpus_h_included
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mdns_network.h"
+
+//
+// Packets as they are seen on a busy network, for the benchmarks
+//
+
+// hostname and service the queries in the corpus ask for
+#define CORPUS_HOSTNAME "bench-host"
+#define CORPUS_SERVICE "_http"
+#define CORPUS_SERVICE_PORT 80
+
+// services found by the responses in the corpus
+#define CORPUS_QUERY_CHROMECAST "_googlecast"
+#define CORPUS_QUERY_PRINTER "_ipp"
+
+typedef struct _corpusPacket {
+    const char *name;
+    uint8_t data[MDNS_MAX_PACKET_SIZE];
+    uint16_t len;
+
+    // source port, queries from other ports than MDNS_PORT are legacy queries
+    uint16_t port;
+
+    // packet is a response
+    bool response;
+} corpusPacket;
+
+// build the corpus, returns the packets and their number
+const corpusPacket *corpus_packets(uint8_t *numPackets);
+
+#endif /* mdns_host_corpus_h_included */
@@ -0,0 +1,349 @@
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_platform.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "mdns_network.h"
+
+//
+// private
+//
+
+static uint32_t currentTime;
+static hostSendCallback *sendCallback;
+
+// the simulated task, a turn ends when it would block or delete itself
+static void *taskArg;
+static hostTaskStep *taskStep;
+static bool inTask;
+static jmp_buf taskTurn;
+
+// send buffers, the library never holds more than a few at a time
+#define HOST_SEND_BUFFERS 4
+
+typedef struct _hostSendSlot {
+    struct pbuf packet;
+    bool used;
+    uint8_t data[MDNS_MAX_PACKET_SIZE];
+} hostSendSlot;
+
+static hostSendSlot sendSlots[HOST_SEND_BUFFERS];
+
+static hostSendSlot *send_slot(mdnsSendBuffer *buffer) {
+#if MDNS_STATIC_ALLOC
+    return &sendSlots[buffer->slot];
+#else
+    return (hostSendSlot *)buffer->packet;
+#endif
+}
+
+static void capture(mdnsSendBuffer *buffer, uint16_t len, ip_addr_t *ipOrNull, uint16_t port) {
+    hostSendSlot *slot = send_slot(buffer);
+
+    if (len > 0) {
+        host_sent.packets++;
+        host_sent.bytes += len;
+        if (ipOrNull) {
+            host_sent.unicastPackets++;
+        }
+        if (sendCallback) {
+            sendCallback(slot->data, len, ipOrNull, port);
+        }
+    }
+    slot->used = false;
+}
+
+//
+// API
+//
+
+hostSentStats host_sent;
+hostHeapStats host_heap;
+
+const ip_addr_t ip_addr_any = { 0 };
+
+void host_set_time(uint32_t now) {
+    currentTime = now;
+}
+
+uint32_t host_time(void) {
+    return currentTime;
+}
+
+void host_reset_sent(void) {
+    memset(&host_sent, 0, sizeof(hostSentStats));
+}
+
+void host_set_send_callback(hostSendCallback *callback) {
+    sendCallback = callback;
+}
+
+void host_set_task_step(hostTaskStep *step) {
+    taskStep = step;
+}
+
+void host_run_task(void) {
+    if (!taskArg || !taskStep || inTask) {
+        return;
+    }
+
+    inTask = true;
+    if (setjmp(taskTurn) == 0) {
+        taskStep(taskArg);
+    }
+    inTask = false;
+}
+
+void host_reset_heap_peak(void) {
+    host_heap.peakBytes = host_heap.liveBytes;
+}
+
+struct pbuf *host_packet_chain(hostPacket *packet, const uint8_t *data, uint16_t len, uint16_t segmentLen) {
+    if ((segmentLen == 0) || (segmentLen > len)) {
+        segmentLen = len;
+    }
+
+    packet->numSegments = 0;
+    uint16_t offset = 0;
+    while ((offset < len) || (packet->numSegments == 0)) {
+        struct pbuf *segment = &packet->segments[packet->numSegments++];
+        uint16_t segLen = (len - offset > segmentLen) ? segmentLen : len - offset;
+        if (packet->numSegments == HOST_MAX_SEGMENTS) {
+            segLen = len - offset; // the last segment takes the rest
+        }
+
+        segment->payload = (void *)(data + offset);
+        segment->len = segLen;
+        segment->tot_len = len - offset;
+        segment->next = NULL;
+        if (packet->numSegments > 1) {
+            packet->segments[packet->numSegments - 2].next = segment;
+        }
+        offset += segLen;
+    }
+
+    return &packet->segments[0];
+}
+
+//
+// libplatform
+//
+
+bool mdns_join_multicast_group(void) {
+    return true;
+}
+
+bool mdns_leave_multicast_group(void) {
+    return true;
+}
+
+mdnsUDPHandle *mdns_listen(mdnsHandle *handle) {
+    static struct udp_pcb pcb;
+    return &pcb;
+}
+
+void mdns_shutdown_socket(mdnsUDPHandle *pcb) {
+}
+
+char *mdns_send_buffer_acquire(mdnsSendBuffer *buffer, uint16_t maxLen) {
+    if (maxLen > MDNS_MAX_PACKET_SIZE) {
+        return NULL;
+    }
+
+    for (uint8_t i = 0; i < HOST_SEND_BUFFERS; i++) {
+        hostSendSlot *slot = &sendSlots[i];
+        if (!slot->used) {
+            slot->used = true;
+#if MDNS_STATIC_ALLOC
+            buffer->slot = i;
+#else
+            slot->packet.payload = slot->data;
+            buffer->packet = &slot->packet;
+#endif
+            return (char *)slot->data;
+        }
+    }
+
+    return NULL;
+}
+
+void mdns_send_buffer_commit(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len) {
+    capture(buffer, len, NULL, MDNS_PORT);
+}
+
+void mdns_send_buffer_commit_to(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len, ip_addr_t *ip, uint16_t port) {
+    capture(buffer, len, ip, port);
+}
+
+void mdns_network_buffer_free(mdnsNetworkBuffer *packet) {
+    // received packets belong to the caller of mdns_parse_packet
+}
+
+//
+// FreeRTOS
+//
+
+// a queue is a ring of items, allocated like on the device
+typedef struct _hostQueue {
+    uint32_t length;
+    uint32_t itemSize;
+    uint32_t head;
+    uint32_t count;
+    uint8_t items[];
+} hostQueue;
+
+xQueueHandle xQueueCreate(uint32_t length, uint32_t itemSize) {
+    hostQueue *queue = malloc(sizeof(hostQueue) + length * itemSize);
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->head = 0;
+    queue->count = 0;
+    return queue;
+}
+
+void vQueueDelete(xQueueHandle queue) {
+    free(queue);
+}
+
+portBASE_TYPE xQueueSendToBack(xQueueHandle handle, const void *item, portTickType ticks) {
+    hostQueue *queue = handle;
+    if ((queue->count == queue->length) && (ticks > 0)) {
+        // a blocked caller lets the task make room, the task itself would wait forever
+        host_run_task();
+    }
+    if (queue->count == queue->length) {
+        return pdFALSE;
+    }
+    uint32_t tail = (queue->head + queue->count) % queue->length;
+    if (queue->itemSize > 0) {
+        memcpy(queue->items + tail * queue->itemSize, item, queue->itemSize);
+    }
+    queue->count++;
+    return pdTRUE;
+}
+
+portBASE_TYPE xQueueReceive(xQueueHandle handle, void *item, portTickType ticks) {
+    hostQueue *queue = handle;
+    if ((queue->count == 0) && (ticks > 0)) {
+        if (inTask) {
+            // the task blocks, which ends its turn
+            longjmp(taskTurn, 1);
+        }
+        // a blocked caller waits for the task
+        host_run_task();
+    }
+    if (queue->count == 0) {
+        return pdFALSE;
+    }
+    if (queue->itemSize > 0) {
+        memcpy(item, queue->items + queue->head * queue->itemSize, queue->itemSize);
+    }
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    return pdTRUE;
+}
+
+portBASE_TYPE xTaskCreate(void (*task)(void *), const char *name, uint16_t stackDepth, void *arg, uint32_t priority, xTaskHandle *handle) {
+    if (taskArg) {
+        return pdFALSE; // only one task is simulated
+    }
+    taskArg = arg;
+    *handle = &taskArg;
+    return pdPASS;
+}
+
+void vTaskDelete(xTaskHandle task) {
+    taskArg = NULL;
+    if ((task == NULL) && inTask) {
+        longjmp(taskTurn, 1);
+    }
+}
+
+xTaskHandle xTaskGetCurrentTaskHandle(void) {
+    return inTask ? &taskArg : NULL;
+}
+
+portTickType xTaskGetTickCount(void) {
+    return currentTime / portTICK_RATE_MS;
+}
+
+//
+// heap tracking, the linker redirects the library's heap calls here
+//
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// every block is prefixed with its size, padded to keep the alignment
+#define HOST_HEAP_HEADER 16
+
+static void count_allocation(size_t size) {
+    host_heap.allocations++;
+    host_heap.allocatedBytes += size;
+    host_heap.liveBytes += size;
+    if (host_heap.liveBytes > host_heap.peakBytes) {
+        host_heap.peakBytes = host_heap.liveBytes;
+    }
+}
+
+void *__wrap_malloc(size_t size) {
+    char *block = __real_malloc(size + HOST_HEAP_HEADER);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t *)block = size;
+    count_allocation(size);
+    return block + HOST_HEAP_HEADER;
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    void *ptr = __wrap_malloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    char *block = (char *)ptr - HOST_HEAP_HEADER;
+    host_heap.frees++;
+    host_heap.liveBytes -= *(size_t *)block;
+    __real_free(block);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return __wrap_malloc(size);
+    }
+    char *block = (char *)ptr - HOST_HEAP_HEADER;
+    size_t oldSize = *(size_t *)block;
+    block = __real_realloc(block, size + HOST_HEAP_HEADER);
+    if (block == NULL) {
+        return NULL;
+    }
+    *(size_t *)block = size;
+    host_heap.liveBytes -= oldSize;
+    count_allocation(size);
+    return block + HOST_HEAP_HEADER;
+}
+
+char *__wrap_strdup(const char *string) {
+    size_t len = strlen(string);
+    char *copy = __wrap_malloc(len + 1);
+    if (copy) {
+        memcpy(copy, string, len + 1);
+    }
+    return copy;
+}
@@ -0,0 +1,66 @@
+#ifndef mdns_host_platform_h_included
+#define mdns_host_platform_h_included
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "platform.h"
+
+//
+// Host replacement of libplatform: sent packets are captured instead of sent,
+// received packets are pbuf chains over plain byte buffers
+//
+
+// simulated time in ms, returned by mdns_now()
+void host_set_time(uint32_t now);
+uint32_t host_time(void);
+
+// packets sent by the library since the last host_reset_sent
+typedef struct _hostSentStats {
+    uint32_t packets;
+    uint32_t unicastPackets;
+    uint64_t bytes;
+} hostSentStats;
+
+extern hostSentStats host_sent;
+
+void host_reset_sent(void);
+
+// called with every sent packet, ipOrNull is NULL for multicast
+typedef void (hostSendCallback)(const uint8_t *data, uint16_t len, ip_addr_t *ipOrNull, uint16_t port);
+void host_set_send_callback(hostSendCallback *callback);
+
+// the MDNS task: xTaskCreate registers it and it only runs when host_run_task is called, or
+// when the library yields to it while stopping. A turn is one pass of the task loop at the
+// simulated time (host_task_step), it ends early where the task would block or yield.
+typedef void (hostTaskStep)(void *arg);
+void host_set_task_step(hostTaskStep *step);
+void host_run_task(void);
+
+// heap use of everything linked with --wrap=malloc,calloc,realloc,free,strdup
+typedef struct _hostHeapStats {
+    uint64_t allocations; // calls that returned memory
+    uint64_t frees;
+    uint64_t allocatedBytes;
+    int64_t liveBytes;
+    int64_t peakBytes;
+} hostHeapStats;
+
+extern hostHeapStats host_heap;
+
+// peak starts over at the current live bytes
+void host_reset_heap_peak(void);
+
+// received packet as a pbuf chain, the payload is split into segments of segmentLen
+// bytes (zero for one pbuf). The chain points into data, which has to stay valid.
+#define HOST_MAX_SEGMENTS 32
+
+typedef struct _hostPacket {
+    struct pbuf segments[HOST_MAX_SEGMENTS];
+    uint8_t numSegments;
+} hostPacket;
+
+struct pbuf *host_packet_chain(hostPacket *packet, const uint8_t *data, uint16_t len, uint16_t segmentLen);
+
+#endif /* mdns_host_platform_h_included */
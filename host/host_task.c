@@ -0,0 +1,16 @@
+#include "server.h"
+
+#include "host_task.h"
+
+void host_task_step(void *userData) {
+    // the queue is never waited on, the replay moves the clock to the next deadline instead
+    mdns_server_task_step(userData, 0);
+}
+
+uint32_t host_task_deadline(mdnsHandle *handle) {
+    uint32_t timeout = mdns_server_task_timeout(handle);
+    if (timeout == MDNS_NO_DEADLINE) {
+        return MDNS_NO_DEADLINE;
+    }
+    return mdns_now() + timeout;
+}
@@ -0,0 +1,13 @@
+#ifndef mdns_host_task_h_included
+#define mdns_host_task_h_included
+
+#include <mdns/mdns.h>
+
+// one pass of the loop of mdns_server_task at the simulated time: handles the queued
+// messages and runs the events that are due, register it with host_set_task_step
+void host_task_step(void *userData);
+
+// simulated time the next event of the task is due, MDNS_NO_DEADLINE if nothing is scheduled
+uint32_t host_task_deadline(mdnsHandle *handle);
+
+#endif /* mdns_host_task_h_included */
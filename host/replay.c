@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mdns/mdns.h>
+
+#include "host_platform.h"
+#include "host_task.h"
+
+#include "mdns_network.h"
+#include "scheduler.h"
+
+//
+// Replays the mDNS packets of a pcap file through a responder with the configured services,
+// at the pace of the capture on the simulated clock. Usage:
+//
+//   replay [-j] [-l loops] [-H hostname] [-a ip] [-s service] [-q query] file.pcap
+//
+// A service is name:protocol:port[:key=value,...] (for example _http:tcp:80:path=/),
+// a query is name:protocol. Without -s one _http service on port 80 is published.
+//
+
+#define REPLAY_MAX_SERVICES 64
+#define REPLAY_MAX_QUERIES 8
+
+// time after the last packet for delayed responses and follow-up queries in ms
+#define REPLAY_DRAIN_TIME 5000
+
+// latency histogram: 8 buckets per power of two, below 8 ns one per ns
+#define LATENCY_BUCKETS (64 * 8)
+
+typedef struct _replayStats {
+    // packets of the capture
+    uint64_t frames;
+    uint64_t packets;  // mDNS packets handed to the responder
+    uint64_t skipped;  // other traffic, IPv6, fragments, our own packets
+    uint32_t duration; // of the capture in ms, all loops
+
+    // what the responder sent during the replay
+    uint64_t responses;
+    uint64_t unicastResponses;
+    uint64_t queries;
+    uint64_t sentBytes;
+
+    // time spent in the responder
+    uint64_t packetNs;
+    uint64_t timerNs;
+    uint64_t maxLatency;
+    uint64_t latency[LATENCY_BUCKETS];
+
+    // heap use relative to before mdns_create
+    uint64_t allocations;
+    int64_t peakBytes;
+    int64_t leakedBytes;
+} replayStats;
+
+static replayStats stats;
+
+// options
+static bool jsonOutput;
+static uint32_t loops = 1;
+static char *hostname = "esp8266";
+static ip_address_t hostIP = { .addr8 = { 192, 168, 1, 250 } };
+static char *serviceSpecs[REPLAY_MAX_SERVICES];
+static uint8_t numServiceSpecs;
+static char *querySpecs[REPLAY_MAX_QUERIES];
+static uint8_t numQuerySpecs;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//
+// latency
+//
+
+static uint16_t latency_bucket(uint64_t ns) {
+    if (ns < 8) {
+        return ns;
+    }
+    uint8_t msb = 63 - __builtin_clzll(ns);
+    return msb * 8 + ((ns >> (msb - 3)) & 7);
+}
+
+// lower bound of a bucket
+static uint64_t bucket_latency(uint16_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (uint64_t)(8 + (bucket & 7)) << ((bucket / 8) - 3);
+}
+
+static void record_latency(uint64_t ns) {
+    stats.latency[latency_bucket(ns)]++;
+    if (ns > stats.maxLatency) {
+        stats.maxLatency = ns;
+    }
+}
+
+static uint64_t latency_percentile(double percentile) {
+    uint64_t rank = (uint64_t)(stats.packets * percentile / 100.0);
+    uint64_t seen = 0;
+    for (uint16_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats.latency[i];
+        if (seen > rank) {
+            return bucket_latency(i);
+        }
+    }
+    return stats.maxLatency;
+}
+
+//
+// responder
+//
+
+static void sent_packet(const uint8_t *data, uint16_t len, ip_addr_t *ipOrNull, uint16_t port) {
+    stats.sentBytes += len;
+    if ((len > 2) && (data[2] & 0x80)) {
+        stats.responses++;
+        if (ipOrNull) {
+            stats.unicastResponses++;
+        }
+    } else {
+        stats.queries++;
+    }
+}
+
+static mdnsProtocol parse_protocol(const char *protocol) {
+    return (protocol && (strcmp(protocol, "udp") == 0)) ? mdnsProtocolUDP : mdnsProtocolTCP;
+}
+
+static mdnsService *create_service(char *spec) {
+    char *name = strtok(spec, ":");
+    char *protocol = strtok(NULL, ":");
+    char *port = strtok(NULL, ":");
+    char *txt = strtok(NULL, "");
+
+    mdnsService *service = mdns_create_service(name, parse_protocol(protocol), port ? atoi(port) : 80);
+    if (service && txt) {
+        for (char *entry = strtok(txt, ","); entry; entry = strtok(NULL, ",")) {
+            char *value = strchr(entry, '=');
+            if (value) {
+                *value++ = '\0';
+            }
+            mdns_service_add_txt(service, entry, value ? value : "");
+        }
+    }
+    return service;
+}
+
+static void *found_service(mdnsService *service) {
+    return NULL;
+}
+
+// give the task a turn for every event that is due until time, like its timeouts would
+static void run_until(mdnsHandle *handle, uint32_t time) {
+    uint32_t deadline;
+    while (((deadline = host_task_deadline(handle)) != MDNS_NO_DEADLINE) && ((int32_t)(deadline - time) <= 0)) {
+        host_set_time(deadline);
+
+        uint64_t start = now_ns();
+        host_run_task();
+        stats.timerNs += now_ns() - start;
+    }
+    host_set_time(time);
+}
+
+static void receive(mdnsHandle *handle, const uint8_t *payload, uint16_t len, ip_addr_t *ip, uint16_t port) {
+    hostPacket chain;
+    struct pbuf *packet = host_packet_chain(&chain, payload, len, 0);
+
+    uint64_t start = now_ns();
+    mdns_receive_packet(handle, packet, ip, port);
+    host_run_task();
+    uint64_t ns = now_ns() - start;
+
+    stats.packets++;
+    stats.packetNs += ns;
+    record_latency(ns);
+}
+
+//
+// pcap
+//
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_LINUX_SLL2 276
+
+typedef struct _pcapFile {
+    FILE *file;
+    bool swapped;
+    bool nanoseconds;
+    uint32_t linkType;
+} pcapFile;
+
+static uint32_t swap32(uint32_t value) {
+    return __builtin_bswap32(value);
+}
+
+static uint32_t pcap32(pcapFile *pcap, const uint8_t *data) {
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return pcap->swapped ? swap32(value) : value;
+}
+
+static uint16_t get16(const uint8_t *data) {
+    return (data[0] << 8) | data[1];
+}
+
+static bool pcap_open(pcapFile *pcap, const char *path) {
+    uint8_t header[24];
+
+    pcap->file = fopen(path, "rb");
+    if ((pcap->file == NULL) || (fread(header, 1, sizeof(header), pcap->file) != sizeof(header))) {
+        fprintf(stderr, "replay: can not read %s\n", path);
+        return false;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, header, 4);
+    pcap->swapped = (magic == swap32(PCAP_MAGIC)) || (magic == swap32(PCAP_MAGIC_NS));
+    magic = pcap->swapped ? swap32(magic) : magic;
+    if ((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NS)) {
+        fprintf(stderr, "replay: %s is not a pcap file (pcapng has to be converted first)\n", path);
+        return false;
+    }
+    pcap->nanoseconds = (magic == PCAP_MAGIC_NS);
+    pcap->linkType = pcap32(pcap, header + 20) & 0xffff;
+
+    return true;
+}
+
+// read the next frame, returns its length or -1 at the end of the file
+static int32_t pcap_next(pcapFile *pcap, uint8_t *frame, uint32_t size, uint64_t *timestampMs) {
+    uint8_t header[16];
+    if (fread(header, 1, sizeof(header), pcap->file) != sizeof(header)) {
+        return -1;
+    }
+
+    uint32_t seconds = pcap32(pcap, header);
+    uint32_t fraction = pcap32(pcap, header + 4);
+    uint32_t len = pcap32(pcap, header + 8);
+    *timestampMs = (uint64_t)seconds * 1000 + fraction / (pcap->nanoseconds ? 1000000 : 1000);
+
+    if (len > size) {
+        fseek(pcap->file, len, SEEK_CUR);
+        return 0;
+    }
+    if (fread(frame, 1, len, pcap->file) != len) {
+        return -1;
+    }
+    return len;
+}
+
+// find the IPv4 packet in a frame, returns its offset or -1
+static int32_t ipv4_offset(pcapFile *pcap, const uint8_t *frame, uint32_t len) {
+    uint32_t offset;
+    uint16_t protocol;
+
+    switch (pcap->linkType) {
+        case LINKTYPE_NULL:
+            return ((len > 4) && ((frame[0] == 2) || (frame[3] == 2))) ? 4 : -1;
+
+        case LINKTYPE_ETHERNET:
+            offset = 12;
+            protocol = (len > 14) ? get16(frame + offset) : 0;
+            while ((protocol == 0x8100) || (protocol == 0x88a8)) {
+                // VLAN tags
+                offset += 4;
+                protocol = (len > offset + 2) ? get16(frame + offset) : 0;
+            }
+            return (protocol == 0x0800) ? offset + 2 : -1;
+
+        case LINKTYPE_LINUX_SLL:
+            return ((len > 16) && (get16(frame + 14) == 0x0800)) ? 16 : -1;
+
+        case LINKTYPE_LINUX_SLL2:
+            return ((len > 20) && (get16(frame) == 0x0800)) ? 20 : -1;
+
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+            return ((len > 0) && ((frame[0] >> 4) == 4)) ? 0 : -1;
+    }
+    return -1;
+}
+
+// feed the mDNS payload of a frame to the responder, returns false if it is something else
+static bool replay_frame(mdnsHandle *handle, pcapFile *pcap, const uint8_t *frame, uint32_t len) {
+    int32_t offset = ipv4_offset(pcap, frame, len);
+    if (offset < 0) {
+        return false;
+    }
+
+    // IPv4 header, the responder only listens on the IPv4 multicast group
+    const uint8_t *ip = frame + offset;
+    len -= offset;
+    if ((len < 20) || ((ip[0] >> 4) != 4) || (ip[9] != 17)) {
+        return false;
+    }
+    uint8_t headerLen = (ip[0] & 0x0f) * 4;
+    if ((get16(ip + 6) & 0x3fff) || (len < headerLen + 8u)) {
+        return false; // fragments are reassembled by the stack
+    }
+
+    ip_addr_t source;
+    memcpy(&source.addr, ip + 12, 4);
+    if (source.addr == hostIP.addr) {
+        return false; // the capture may contain our own packets
+    }
+
+    // UDP header
+    const uint8_t *udp = ip + headerLen;
+    uint16_t sourcePort = get16(udp);
+    uint16_t destinationPort = get16(udp + 2);
+    uint16_t udpLen = get16(udp + 4);
+    if ((destinationPort != MDNS_PORT) || (udpLen < 8 + 12) || (udpLen > len - headerLen)) {
+        return false;
+    }
+
+    receive(handle, udp + 8, udpLen - 8, &source, sourcePort);
+    return true;
+}
+
+//
+// output
+//
+
+static void report(void) {
+    double packetSeconds = stats.packetNs / 1e9;
+    double busySeconds = (stats.packetNs + stats.timerNs) / 1e9;
+    double packetsPerSecond = (busySeconds > 0) ? stats.packets / busySeconds : 0;
+    double meanLatency = stats.packets ? (double)stats.packetNs / stats.packets : 0;
+
+    if (jsonOutput) {
+        printf("{\"frames\": %llu, \"packets\": %llu, \"skipped\": %llu, \"capture_seconds\": %.3f, "
+            "\"packets_per_second\": %.1f, \"packet_seconds\": %.6f, \"timer_seconds\": %.6f, "
+            "\"responses\": %llu, \"unicast_responses\": %llu, \"queries\": %llu, \"sent_bytes\": %llu, "
+            "\"allocations\": %llu, \"peak_heap_bytes\": %lld, \"leaked_bytes\": %lld, "
+            "\"latency_ns\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}\n",
+            (unsigned long long)stats.frames, (unsigned long long)stats.packets, (unsigned long long)stats.skipped,
+            stats.duration / 1000.0, packetsPerSecond, packetSeconds, stats.timerNs / 1e9,
+            (unsigned long long)stats.responses, (unsigned long long)stats.unicastResponses,
+            (unsigned long long)stats.queries, (unsigned long long)stats.sentBytes,
+            (unsigned long long)stats.allocations, (long long)stats.peakBytes, (long long)stats.leakedBytes,
+            meanLatency, (unsigned long long)latency_percentile(50), (unsigned long long)latency_percentile(90),
+            (unsigned long long)latency_percentile(99), (unsigned long long)latency_percentile(99.9),
+            (unsigned long long)stats.maxLatency);
+        return;
+    }
+
+    printf("capture      %.1f s, %llu frames, %llu mDNS packets, %llu skipped\n",
+        stats.duration / 1000.0, (unsigned long long)stats.frames, (unsigned long long)stats.packets, (unsigned long long)stats.skipped);
+    printf("throughput   %.0f packets/s (%.3f s parsing, %.3f s timers)\n", packetsPerSecond, packetSeconds, stats.timerNs / 1e9);
+    printf("sent         %llu responses (%llu unicast), %llu queries, %llu bytes\n",
+        (unsigned long long)stats.responses, (unsigned long long)stats.unicastResponses, (unsigned long long)stats.queries, (unsigned long long)stats.sentBytes);
+    printf("heap         %llu allocations, %lld bytes peak, %lld bytes leaked\n",
+        (unsigned long long)stats.allocations, (long long)stats.peakBytes, (long long)stats.leakedBytes);
+    printf("latency      mean %.0f ns, p50 %llu ns, p90 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+        meanLatency, (unsigned long long)latency_percentile(50), (unsigned long long)latency_percentile(90),
+        (unsigned long long)latency_percentile(99), (unsigned long long)latency_percentile(99.9), (unsigned long long)stats.maxLatency);
+}
+
+//
+// main
+//
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-j] [-l loops] [-H hostname] [-a ip] [-s name:tcp|udp:port[:key=value,...]] [-q name:tcp|udp] file.pcap\n", name);
+}
+
+int main(int argc, char **argv) {
+    int option;
+    while ((option = getopt(argc, argv, "jl:H:a:s:q:")) != -1) {
+        switch (option) {
+            case 'j':
+                jsonOutput = true;
+                break;
+            case 'l':
+                loops = strtoul(optarg, NULL, 10);
+                break;
+            case 'H':
+                hostname = optarg;
+                break;
+            case 'a': {
+                unsigned int a, b, c, d;
+                if (sscanf(optarg, "%u.%u.%u.%u", &a, &b, &c, &d) != 4) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                hostIP.addr8[0] = a; hostIP.addr8[1] = b; hostIP.addr8[2] = c; hostIP.addr8[3] = d;
+                break;
+            }
+            case 's':
+                if (numServiceSpecs < REPLAY_MAX_SERVICES) {
+                    serviceSpecs[numServiceSpecs++] = optarg;
+                }
+                break;
+            case 'q':
+                if (numQuerySpecs < REPLAY_MAX_QUERIES) {
+                    querySpecs[numQuerySpecs++] = optarg;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (numServiceSpecs == 0) {
+        static char defaultService[] = "_http:tcp:80:path=/";
+        serviceSpecs[numServiceSpecs++] = defaultService;
+    }
+    if (loops == 0) {
+        loops = 1;
+    }
+
+    pcapFile pcap;
+    if (!pcap_open(&pcap, argv[optind])) {
+        return 1;
+    }
+
+    // the clock starts at some time after boot, zero means never multicast
+    uint32_t startTime = 10000;
+    host_set_time(startTime);
+    host_set_send_callback(sent_packet);
+    host_set_task_step(host_task_step);
+
+    hostHeapStats heapBefore = host_heap;
+    host_reset_heap_peak();
+
+    mdnsHandle *handle = mdns_create(hostname);
+    if (handle == NULL) {
+        return 1;
+    }
+    ip6_address_t ip6 = { { 0 } };
+    mdns_update_ip(handle, hostIP, ip6);
+
+    for (uint8_t i = 0; i < numServiceSpecs; i++) {
+        mdnsService *service = create_service(serviceSpecs[i]);
+        if (service) {
+            mdns_add_service(handle, service);
+        }
+    }
+
+    mdnsQueryHandle *queries[REPLAY_MAX_QUERIES];
+    for (uint8_t i = 0; i < numQuerySpecs; i++) {
+        char *name = strtok(querySpecs[i], ":");
+        queries[i] = mdns_query(handle, name, parse_protocol(strtok(NULL, ":")), found_service);
+    }
+
+    // announcements are part of the traffic
+    mdns_start(handle);
+    run_until(handle, startTime);
+
+    static uint8_t frame[65536];
+    uint32_t offset = startTime;
+    for (uint32_t loop = 0; loop < loops; loop++) {
+        uint64_t first = 0;
+        uint64_t timestamp = 0;
+        uint32_t duration = 0;
+        int32_t len;
+
+        fseek(pcap.file, 24, SEEK_SET);
+        while ((len = pcap_next(&pcap, frame, sizeof(frame), &timestamp)) >= 0) {
+            if (first == 0) {
+                first = timestamp;
+            }
+            if (timestamp < first + duration) {
+                timestamp = first + duration; // captures are not always ordered
+            }
+            duration = timestamp - first;
+            stats.frames++;
+
+            run_until(handle, offset + duration);
+            if (!replay_frame(handle, &pcap, frame, len)) {
+                stats.skipped++;
+            }
+        }
+
+        // the next loop continues a second after this one ended
+        stats.duration += duration;
+        offset += duration + 1000;
+    }
+
+    // send what is still delayed
+    run_until(handle, host_time() + REPLAY_DRAIN_TIME);
+
+    for (uint8_t i = 0; i < numQuerySpecs; i++) {
+        if (queries[i]) {
+            mdns_query_destroy(handle, queries[i]);
+        }
+    }
+
+    // goodbye packets are not counted
+    host_set_send_callback(NULL);
+    mdns_destroy(handle);
+
+    stats.allocations = host_heap.allocations - heapBefore.allocations;
+    stats.peakBytes = host_heap.peakBytes - heapBefore.liveBytes;
+    stats.leakedBytes = host_heap.liveBytes - heapBefore.liveBytes;
+
+    report();
+
+    fclose(pcap.file);
+    return (stats.leakedBytes == 0) ? 0 : 2;
+}
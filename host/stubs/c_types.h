@@ -0,0 +1,15 @@
+#ifndef host_c_types_h_included
+#define host_c_types_h_included
+
+// ESP8266 SDK types and section attributes, constants stay in RAM on the host
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_ATTR
+
+#define os_printf printf
+
+#endif /* host_c_types_h_included */
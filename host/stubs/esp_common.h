@@ -0,0 +1,6 @@
+#ifndef host_esp_common_h_included
+#define host_esp_common_h_included
+
+#include "c_types.h"
+
+#endif /* host_esp_common_h_included */
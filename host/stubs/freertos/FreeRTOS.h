@@ -0,0 +1,22 @@
+#ifndef host_freertos_h_included
+#define host_freertos_h_included
+
+// FreeRTOS as far as the library uses it, implemented in host_platform.c.
+// There is no scheduler on the host: the task only runs when host_run_task gives it
+// a turn, which a caller blocking on a queue does too, and the tick count is the
+// simulated time set with host_set_time.
+
+#include <stdint.h>
+
+typedef long portBASE_TYPE;
+typedef uint32_t portTickType;
+typedef void *xQueueHandle;
+typedef void *xTaskHandle;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY 0xffffffff
+#define portTICK_RATE_MS 1
+
+#endif /* host_freertos_h_included */
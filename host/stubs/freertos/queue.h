@@ -0,0 +1,11 @@
+#ifndef host_freertos_queue_h_included
+#define host_freertos_queue_h_included
+
+#include "freertos/FreeRTOS.h"
+
+xQueueHandle xQueueCreate(uint32_t length, uint32_t itemSize);
+void vQueueDelete(xQueueHandle queue);
+portBASE_TYPE xQueueSendToBack(xQueueHandle queue, const void *item, portTickType ticks);
+portBASE_TYPE xQueueReceive(xQueueHandle queue, void *item, portTickType ticks);
+
+#endif /* host_freertos_queue_h_included */
@@ -0,0 +1,14 @@
+#ifndef host_freertos_semphr_h_included
+#define host_freertos_semphr_h_included
+
+#include "freertos/queue.h"
+
+// binary semaphores are queues of one empty item, like in FreeRTOS
+typedef xQueueHandle xSemaphoreHandle;
+
+#define vSemaphoreCreateBinary(semaphore) do { (semaphore) = xQueueCreate(1, 0); if (semaphore) xSemaphoreGive(semaphore); } while (0)
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+#define xSemaphoreTake(semaphore, ticks) xQueueReceive((semaphore), NULL, (ticks))
+#define xSemaphoreGive(semaphore) xQueueSendToBack((semaphore), NULL, 0)
+
+#endif /* host_freertos_semphr_h_included */
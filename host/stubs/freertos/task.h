@@ -0,0 +1,14 @@
+#ifndef host_freertos_task_h_included
+#define host_freertos_task_h_included
+
+#include "freertos/FreeRTOS.h"
+
+portBASE_TYPE xTaskCreate(void (*task)(void *), const char *name, uint16_t stackDepth, void *arg, uint32_t priority, xTaskHandle *handle);
+void vTaskDelete(xTaskHandle task);
+xTaskHandle xTaskGetCurrentTaskHandle(void);
+portTickType xTaskGetTickCount(void);
+
+#define taskENTER_CRITICAL()
+#define taskEXIT_CRITICAL()
+
+#endif /* host_freertos_task_h_included */
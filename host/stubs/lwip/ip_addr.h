@@ -0,0 +1,17 @@
+#ifndef host_lwip_ip_addr_h_included
+#define host_lwip_ip_addr_h_included
+
+#include "lwip/opt.h"
+
+typedef struct ip_addr {
+    u32_t addr;
+} ip_addr_t;
+
+typedef struct ip6_addr {
+    u32_t addr[4];
+} ip6_addr_t;
+
+extern const ip_addr_t ip_addr_any;
+#define IP_ADDR_ANY ((ip_addr_t *)&ip_addr_any)
+
+#endif /* host_lwip_ip_addr_h_included */
@@ -0,0 +1,6 @@
+#ifndef host_lwip_mem_h_included
+#define host_lwip_mem_h_included
+
+#include "lwip/opt.h"
+
+#endif /* host_lwip_mem_h_included */
@@ -0,0 +1,21 @@
+#ifndef host_lwip_opt_h_included
+#define host_lwip_opt_h_included
+
+// just enough of lwip to build the library and platform layer on the host
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+typedef s8_t err_t;
+
+#define ERR_OK 0
+#define ERR_MEM -1
+
+#endif /* host_lwip_opt_h_included */
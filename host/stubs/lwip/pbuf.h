@@ -0,0 +1,14 @@
+#ifndef host_lwip_pbuf_h_included
+#define host_lwip_pbuf_h_included
+
+#include "lwip/opt.h"
+
+// received packets are chains of these, see host_packet_chain
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    u16_t tot_len;
+    u16_t len;
+};
+
+#endif /* host_lwip_pbuf_h_included */
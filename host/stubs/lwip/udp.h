@@ -0,0 +1,12 @@
+#ifndef host_lwip_udp_h_included
+#define host_lwip_udp_h_included
+
+#include "lwip/opt.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct udp_pcb {
+    u8_t ttl;
+};
+
+#endif /* host_lwip_udp_h_included */
@@ -25,7 +25,59 @@
 #define MDNS_ENABLE_QUERY 0
 #endif /* MDNS_BROADCAST_ONLY */
 
+// Take all storage from fixed pools sized by the limits below instead of the heap,
+// the library does not allocate after mdns_create (Disabled by default)
+#ifndef MDNS_STATIC_ALLOC
+#define MDNS_STATIC_ALLOC 0
+#endif
+
+#if MDNS_STATIC_ALLOC
+// number of MDNS handles
+#ifndef MDNS_MAX_HANDLES
+#define MDNS_MAX_HANDLES 1
+#endif
+
+// number of services, for all handles together
+#ifndef MDNS_MAX_SERVICES
+#define MDNS_MAX_SERVICES 4
+#endif
+
+// number of TXT records of a service
+#ifndef MDNS_MAX_TXT_RECORDS
+#define MDNS_MAX_TXT_RECORDS 8
+#endif
+
+// bytes for the keys and values of the TXT records of a service, including a terminator each
+#ifndef MDNS_MAX_TXT_BYTES
+#define MDNS_MAX_TXT_BYTES 128
+#endif
+
+// number of queries, for all handles together
+#ifndef MDNS_MAX_QUERIES
+#define MDNS_MAX_QUERIES 2
+#endif
+
+// bytes for the TXT records of a found service handed to a query callback, others are left out
+#ifndef MDNS_QUERY_TXT_SIZE
+#define MDNS_QUERY_TXT_SIZE 256
+#endif
+
+// bytes of pre-serialized responses kept per handle
+#ifndef MDNS_RESPONSE_CACHE_SIZE
+#define MDNS_RESPONSE_CACHE_SIZE 1024
+#endif
+
+// number of packets that can be serialized or waiting to be sent at the same time,
+// MDNS_MAX_PACKET_SIZE bytes each
+#ifndef MDNS_SEND_BUFFERS
+#define MDNS_SEND_BUFFERS 2
+#endif
+
+// MDNS_MAX_PACKET_SIZE and MDNS_RECORD_CACHE_SIZE (received records) are fixed in both modes
+#endif /* MDNS_STATIC_ALLOC */
+
 #include <stdint.h>
+#include <stdbool.h>
 
 typedef union ip_address {
     uint32_t addr;
@@ -43,7 +95,7 @@ typedef struct ip6_address {
 // MDNS Server handle
 typedef struct _mdnsHandle mdnsHandle;
 
-// Create a MDNS server for specified hostname
+// Create a MDNS server for specified hostname, returns NULL if the handle pool is exhausted
 mdnsHandle *mdns_create(char *hostname);
 
 // Start broadcasting MDNS records
@@ -58,7 +110,8 @@ void mdns_restart(mdnsHandle *handle);
 // Destroy MDNS handle
 void mdns_destroy(mdnsHandle *handle);
 
-// Set IP address of station, call this in the DHCP callback to update IP
+// Set IP address of station, call this in the DHCP callback to update IP.
+// A running service keeps its socket and only announces the new address records.
 void mdns_update_ip(mdnsHandle *handle, const ip_address_t ip, const ip6_address_t ip6);
 
 
@@ -78,9 +131,28 @@ typedef struct _mdnsTxtRecord {
     char *value;
 } mdnsTxtRecord;
 
+// Service that is known at build time, see MDNS_DECLARE_SERVICE
+typedef struct _mdnsServiceDeclaration {
+    // name of the service and its length, in flash
+    const char *name;
+    uint8_t nameLen;
+
+    // protocol type and port of the service
+    mdnsProtocol protocol;
+    uint16_t port;
+
+    // wire format name: _type._protocol.local, in flash
+    const char *typeName;
+    uint8_t typeNameLen;
+
+    // TXT record data in wire format, in flash and 4 byte aligned, NULL without TXT record
+    const void *txt;
+    uint16_t txtLen;
+} mdnsServiceDeclaration;
+
 // MDNS Service handle
 typedef struct _mdnsService {
-    // name of the service (for example "http")
+    // name of the service (for example "http"), the instance name in query results
     char *name;
 
     // protocol type (TCP or UDP)
@@ -94,30 +166,132 @@ typedef struct _mdnsService {
     // number of TXT records
     uint8_t numTxtRecords;
 
+    // MDNS handle this service has been added to (internal)
+    mdnsHandle *handle;
+
+    // precalculated length and hash of the name label (internal)
+    uint8_t nameLen;
+    uint32_t nameHash;
+
+    // pre-encoded wire format names and their lengths (internal)
+    char *typeName;     // _type._protocol.local
+    uint8_t typeNameLen;
+    char *instanceName; // hostname._type._protocol.local, set when added to a handle
+    uint8_t instanceNameLen;
+
+    // service lookup index keys and bucket chains (internal)
+    uint32_t typeKey;
+    uint32_t instanceKey;
+    struct _mdnsService *nextType;
+    struct _mdnsService *nextInstance;
+
+    // records queued for the response that is being built (internal)
+    uint8_t queuedAnswers;
+    uint8_t queuedAdditionals;
+
+    // time the PTR, SRV and TXT records were last multicast in ms, zero if never (internal)
+    uint32_t lastMulticast[3];
+
+    // service is part of the running announcement of new or changed services (internal)
+    uint8_t announce;
+
+    // build time declaration the names and TXT records are taken from, NULL if created at runtime (internal)
+    const mdnsServiceDeclaration *declaration;
+
+    // handle the service was added to by the caller, the task sets handle when it gets there (internal)
+    mdnsHandle *owner;
+
+    // commands on the service the task did not handle yet, a destroy meanwhile is left to the task (internal)
+    volatile uint8_t pendingCommands;
+    volatile bool destroyPending;
+
 #if defined(MDNS_ENABLE_QUERY) && MDNS_ENABLE_QUERY
     // IP address of the service
     // only used when this is a query response
-    struct ip_addr ip;
+    ip_address_t ip;
 #endif
 } mdnsService;
 
 #if defined(MDNS_ENABLE_PUBLISH) && MDNS_ENABLE_PUBLISH
 
-// Create a new service record
+// Create a new service record, returns NULL if the service pool is exhausted
 mdnsService *mdns_create_service(char *name, mdnsProtocol protocol, uint16_t port);
 
-// Add TXT record to service record
-void mdns_service_add_txt(mdnsService *service, char *key, char *value);
+// Create a service from a build time declaration, the declaration has to stay valid.
+// Returns NULL if the service pool is exhausted.
+mdnsService *mdns_create_declared_service(const mdnsServiceDeclaration *declaration);
+
+// Add TXT record to service record. Returns false if it does not fit, the service is declared
+// at build time or the MDNS task has too many commands queued. Never blocks.
+bool mdns_service_add_txt(mdnsService *service, char *key, char *value);
 
-// Add service to MDNS broadcaster
-void mdns_add_service(mdnsHandle *handle, mdnsService *service);
+// Add service to MDNS broadcaster, returns false if the MDNS task has too many commands queued.
+// Never blocks, the task announces services added together at once. The service is ignored
+// if it was added already or all MDNS_MAX_SERVICES slots of a static build are taken.
+bool mdns_add_service(mdnsHandle *handle, mdnsService *service);
 
-// Remove service from MDNS broadcaster
-void mdns_remove_service(mdnsHandle *handle, mdnsService *service);
+// Remove service from MDNS broadcaster, returns false if the MDNS task has too many commands
+// queued. Never blocks, a running service says goodbye for it in the background.
+bool mdns_remove_service(mdnsHandle *handle, mdnsService *service);
 
-// Destroy a service handle
+// Destroy a service handle, a removed service may be destroyed right away
 void mdns_service_destroy(mdnsService *service);
 
+// Number of response bytes saved by known-answer suppression (RFC 6762 section 7.1)
+uint32_t mdns_known_answer_saved_bytes(mdnsHandle *handle);
+
+//
+// Services declared at build time
+//
+
+// Declare a service with its wire format type name and TXT record data as constants in flash.
+// The names are copied into the service when it is created, the TXT strings into the responses:
+//
+//   #define HTTP_TXT(TXT) TXT("path=/") TXT("version=2")
+//   MDNS_DECLARE_SERVICE(httpService, "_http", TCP, 80, HTTP_TXT);
+//
+//   mdns_add_service(handle, mdns_create_declared_service(&httpService));
+//
+// The name has up to 63 characters, the protocol is TCP or UDP and MDNS_NO_TXT declares
+// a service without TXT record. Every TXT string is a "key=value" literal.
+#define MDNS_DECLARE_SERVICE(_var, _name, _protocol, _port, _txt) \
+    static const char _var##Name[sizeof(_name)] ICACHE_RODATA_ATTR __attribute__((aligned(4))) = _name; \
+    static const struct { \
+        uint8_t nameLen; char name[sizeof(_name) - 1]; \
+        uint8_t protocolLen; char protocol[4]; \
+        uint8_t localLen; char local[5]; \
+        uint8_t terminator; \
+    } _var##TypeName ICACHE_RODATA_ATTR __attribute__((aligned(4))) = { \
+        sizeof(_name) - 1, _name, 4, MDNS_PROTOCOL_LABEL_##_protocol, 5, "local", 0 \
+    }; \
+    static const struct { _txt(MDNS_TXT_FIELD) uint8_t end; } _var##Txt ICACHE_RODATA_ATTR __attribute__((aligned(4))) = { \
+        _txt(MDNS_TXT_VALUE) 0 \
+    }; \
+    static const mdnsServiceDeclaration _var = { \
+        _var##Name, sizeof(_name) - 1, mdnsProtocol##_protocol, _port, \
+        (const char *)&_var##TypeName, sizeof(_var##TypeName), \
+        (sizeof(_var##Txt) > 1) ? &_var##Txt : NULL, sizeof(_var##Txt) - 1 \
+    }
+
+// TXT list of a service without TXT record
+#define MDNS_NO_TXT(_txt)
+
+// helpers of MDNS_DECLARE_SERVICE, every TXT string is a length byte followed by the characters.
+// The TXT data ends with a byte that is not sent, so it is no empty struct without TXT record.
+#define MDNS_PROTOCOL_LABEL_TCP "_tcp"
+#define MDNS_PROTOCOL_LABEL_UDP "_udp"
+#define MDNS_CONCAT_(_a, _b) _a##_b
+#define MDNS_CONCAT(_a, _b) MDNS_CONCAT_(_a, _b)
+#define MDNS_TXT_FIELD(_string) \
+    uint8_t MDNS_CONCAT(len, __COUNTER__); \
+    char MDNS_CONCAT(string, __COUNTER__)[sizeof(_string) - 1];
+#define MDNS_TXT_VALUE(_string) sizeof(_string) - 1, _string,
+
+// constants in flash, provided by the ESP8266 SDK
+#ifndef ICACHE_RODATA_ATTR
+#define ICACHE_RODATA_ATTR
+#endif
+
 #endif /* MDNS_ENABLE_PUBLISH */
 
 
@@ -129,10 +303,12 @@ void mdns_service_destroy(mdnsService *service);
 // MDNS Query handle
 typedef struct _mdnsQueryHandle mdnsQueryHandle;
 
-// Callback for found services
+// Callback for found services, called from the MDNS task. The service and its
+// TXT records are only valid during the call.
 typedef void *(mdnsQueryCallback)(mdnsService *service);
 
-// start a MDNS query, calls callback if something is found
+// start a MDNS query, calls callback when a packet brings new or changed records of an instance.
+// Returns NULL if the query pool is exhausted or the MDNS task has too many commands queued.
 mdnsQueryHandle *mdns_query(mdnsHandle *handle, char *service, mdnsProtocol protocol, mdnsQueryCallback *callback);
 
 // cancel MDNS query
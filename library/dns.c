@@ -1,308 +1,337 @@
+#include <string.h>
+#include <strings.h>
+
 #include "dns.h"
-#include "tools.h"
 #include "server.h"
-#include "mdns_network.h"
+#include "tools.h"
 
 #include "debug.h"
 
-static inline uint16_t sizeof_record_header(char *fqdn) {
-    uint16_t size = 0;
-
-    uint8_t fqdnLen = strlen(fqdn);
+//
+// Name compression
+//
+
+// find the longest suffix of the wire format name that is already in the packet,
+// returns the offset of the first label of that suffix or the length of the name without terminator.
+// Label length bytes are below 64 and never change case, so strcasecmp works on wire format.
+static uint8_t find_suffix(mdnsNameTable *table, const char *name, uint8_t nameLen, uint16_t *pointer) {
+    for (uint8_t i = 0; i < nameLen - 1; i += name[i] + 1) {
+        for (uint8_t j = 0; j < table->numEntries; j++) {
+            if (strcasecmp(table->entries[j].suffix, name + i) == 0) {
+                *pointer = table->entries[j].offset;
+                return i;
+            }
+        }
+    }
 
-    size += fqdnLen + 1;
-    size++; // terminator
-    size += 2; // type
-    size += 2; // class
-    size += 4; // ttl
-    size += 2; // data length
+    return nameLen - 1;
+}
 
-    return size;
+// remember all labels before suffixStart, name has to outlive the table
+static void remember_labels(mdnsNameTable *table, const char *name, uint8_t suffixStart, uint16_t offset) {
+    for (uint8_t i = 0; i < suffixStart; i += name[i] + 1) {
+        if ((table->numEntries >= MDNS_NAME_TABLE_SIZE) || (offset + i > 0x3fff)) {
+            break; // pointers only have 14 bits
+        }
+        table->entries[table->numEntries].suffix = name + i;
+        table->entries[table->numEntries].offset = offset + i;
+        table->numEntries++;
+    }
 }
 
-uint16_t mdns_sizeof_PTR(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    uint16_t size = 0;
+//
+// Writer
+//
+
+void mdns_writer_init(mdnsWriter *writer, char *buffer, uint16_t size) {
+    writer->packet = buffer;
+    writer->ptr = buffer;
+    writer->end = buffer + size;
+    writer->overflow = false;
+    writer->numRecords = 0;
+    writer->cacheFlush = true;
+    writer->names.numEntries = 0;
+}
 
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
-        if (serviceOrNull) {
-            service = serviceOrNull; // service override
-        }
+static inline bool has_room(mdnsWriter *writer, uint16_t len) {
+    return (writer->end - writer->ptr) >= len;
+}
 
-        char *fqdn = mdns_make_service_name(service); // _type._protocol.local
-        size += sizeof_record_header(fqdn);
-        free(fqdn);
+// write a compressed name, the uncompressed labels are copied in one go
+static bool append_name(mdnsWriter *writer, const char *name, uint8_t nameLen) {
+    uint16_t pointer = 0;
+    uint8_t suffixStart = find_suffix(&writer->names, name, nameLen, &pointer);
+    bool compressed = (suffixStart < nameLen - 1);
 
-        // packet data
-        fqdn = mdns_make_fqdn(hostname, service);
-        size += strlen(fqdn) + 2 /* length header + zero byte */;
-        free(fqdn);
+    if (!has_room(writer, compressed ? suffixStart + 2 : nameLen)) {
+        return false;
+    }
 
-        if (serviceOrNull) {
-            break; // short circuit if we only should send one service
-        }
+    remember_labels(&writer->names, name, suffixStart, mdns_writer_len(writer));
+    if (compressed) {
+        memcpy(writer->ptr, name, suffixStart);
+        writer->ptr += suffixStart;
+        *writer->ptr++ = 0xc0 | (pointer >> 8);
+        *writer->ptr++ = pointer & 0xff;
+    } else {
+        memcpy(writer->ptr, name, nameLen); // includes terminator
+        writer->ptr += nameLen;
     }
 
-    return size;
+    return true;
 }
 
-uint16_t mdns_sizeof_SRV(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    uint16_t size = 0;
+//
+// Records
+//
 
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
-        if (serviceOrNull) {
-            service = serviceOrNull; // service override
-        }
-        uint8_t serviceNameLen = strlen(service->name);
-
-        char *fqdn = mdns_make_fqdn(hostname, service); // Hostname._service._protocol.local
-        size += sizeof_record_header(fqdn);
-        free(fqdn);
-        
-        size += 2; // prio
-        size += 2; // weight
-        size += 2; // port
-
-        // target
-        fqdn = mdns_make_local(hostname);
-        size += strlen(fqdn) + 2 /* length header + zero byte */;
-        free(fqdn);
-
-        if (serviceOrNull) {
-            break; // short circuit if we only should send one service
-        }
+// writes the record header, data length is filled in by finish_record.
+// Returns the start of the record data or NULL if the header did not fit.
+static char *record_header(mdnsWriter *writer, const char *name, uint8_t nameLen, mdnsRecordType type, uint32_t ttl) {
+    if (!append_name(writer, name, nameLen) || !has_room(writer, 10)) {
+        return NULL;
     }
+    char *ptr = writer->ptr;
 
-    return size;
+    // type
+    *ptr++ = 0;
+    *ptr++ = type;
+    // class
+    *ptr++ = writer->cacheFlush ? 0x80 : 0x00; // cache buster flag
+    *ptr++ = 0x01; // class: internet
+    // ttl
+    *ptr++ = ttl >> 24;
+    *ptr++ = ttl >> 16;
+    *ptr++ = ttl >> 8;
+    *ptr++ = ttl & 0xff;
+    // data length
+    *ptr++ = 0;
+    *ptr++ = 0;
+
+    writer->ptr = ptr;
+    return ptr;
 }
 
-uint16_t mdns_sizeof_TXT(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    uint16_t size = 0;
+// fill in data length of the record, data starts at data and ends at the write position
+static inline bool finish_record(mdnsWriter *writer, char *data) {
+    uint16_t len = writer->ptr - data;
 
-    // Hostname._servicetype._protocol.local
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
+    data[-2] = len >> 8;
+    data[-1] = len & 0xff;
+    writer->numRecords++;
 
-        if (serviceOrNull) {
-            service = serviceOrNull; // service override
-        }
+    return true;
+}
 
-        if (service->numTxtRecords > 0) {
-            char *fqdn = mdns_make_fqdn(hostname, service); // Servicename._type._protocol.local
-            size += sizeof_record_header(fqdn);
-            free(fqdn);
+// drop a partially written record, the packet ends with the last complete record
+static bool abort_record(mdnsWriter *writer, char *start, uint8_t numEntries) {
+    writer->ptr = start;
+    writer->names.numEntries = numEntries;
+    writer->overflow = true;
 
-            uint8_t txtLen = 0;
-            for(uint8_t j = 0; j < service->numTxtRecords; j++) {
-                txtLen += 1 /* len of txt record k/v pair */;
-                txtLen += strlen(service->txtRecords[j].name) + 1 /* = */;
-                txtLen += strlen(service->txtRecords[j].value);
-            }
-            if (txtLen == 0) {
-                txtLen = 1; // NULL byte sentinel at least
-            }
-            size += txtLen;
-        }
+    LOG(DEBUG, "mdns: record does not fit into the packet");
+    return false;
+}
 
-        if (serviceOrNull) {
-            break; // short circuit if we only should send one service
-        }
+static bool make_PTR(mdnsWriter *writer, uint32_t ttl, mdnsService *service) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
+
+    // _type._protocol.local
+    char *data = record_header(writer, service->typeName, service->typeNameLen, mdnsRecordTypePTR, ttl);
+    if ((data == NULL) || !append_name(writer, service->instanceName, service->instanceNameLen)) {
+        return abort_record(writer, start, numEntries);
     }
 
-    return size;
+    return finish_record(writer, data);
 }
 
-uint16_t mdns_sizeof_A(char *hostname) {
-    uint16_t size = 0;
+static bool make_SRV(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *service) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
 
-    // fqdn
-    char *fqdn = mdns_make_local(hostname);
-    size += sizeof_record_header(fqdn);
-    free(fqdn);
+    // Hostname._service._protocol.local
+    char *data = record_header(writer, service->instanceName, service->instanceNameLen, mdnsRecordTypeSRV, ttl);
+    if ((data == NULL) || !has_room(writer, 6)) {
+        return abort_record(writer, start, numEntries);
+    }
 
-    // ip address
-    size += 4;
+    // prio
+    *writer->ptr++ = 0;
+    *writer->ptr++ = 0;
 
-    return size;
-}
+    // weight
+    *writer->ptr++ = 0;
+    *writer->ptr++ = 0;
 
-uint16_t mdns_sizeof_AAAA(char *hostname, ip6_address_t ip) {
-    uint16_t size = 0;
-    ip6_addr_t zero = { 0 };
-    if (memcmp(&zero, &ip, sizeof(ip6_addr_t)) == 0) {
-        return 0;
+    // port
+    *writer->ptr++ = service->port >> 8;
+    *writer->ptr++ = service->port & 0xff;
+
+    // target
+    if (!append_name(writer, handle->localName, handle->localNameLen)) {
+        return abort_record(writer, start, numEntries);
     }
 
-    // fqdn
-    char *fqdn = mdns_make_local(hostname);
-    size += sizeof_record_header(fqdn);
-    free(fqdn);
+    return finish_record(writer, data);
+}
 
-    // ip address
-    size += 16;
+static bool make_TXT(mdnsWriter *writer, uint32_t ttl, mdnsService *service) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
 
-    return size;
-}
+    // Servicename._type._protocol.local
+    char *data = record_header(writer, service->instanceName, service->instanceNameLen, mdnsRecordTypeTXT, ttl);
+    if (data == NULL) {
+        return abort_record(writer, start, numEntries);
+    }
 
-static char *append_tokenized(char *buffer, char *domain) {
-    uint8_t len = strlen(domain);
-    
-    // calculate lengts
-    uint8_t parts[5];
-    uint8_t partIndex = 0;
-    uint8_t lastLen = 0;
-    for (uint8_t i = 0; i < len; i++) {
-        if (domain[i] == '.') {
-            parts[partIndex++] = i - lastLen;
-            lastLen = i + 1;
+    if (service->declaration) {
+        // declared in wire format
+        uint16_t len = service->declaration->txtLen;
+        if (!has_room(writer, len)) {
+            return abort_record(writer, start, numEntries);
         }
+        mdns_flash_read(writer->ptr, service->declaration->txt, len);
+        writer->ptr += len;
     }
-    parts[partIndex] = len - lastLen;
 
-    // write part entries
-    partIndex = 0;
-    for (uint8_t i = 0; i < len; i++) {
-        if ((i == 0) || (domain[i] == '.')) {
-            *buffer++ = parts[partIndex++];
+    for(uint8_t j = 0; j < service->numTxtRecords; j++) {
+        uint16_t namLen = strlen(service->txtRecords[j].name);
+        uint16_t valLen = strlen(service->txtRecords[j].value);
+        if (!has_room(writer, 1 + namLen + 1 + valLen)) {
+            return abort_record(writer, start, numEntries);
         }
-        if (domain[i] != '.') {
-            *buffer++ = domain[i];
+
+        *writer->ptr++ = namLen + 1 + valLen;
+        memcpy(writer->ptr, service->txtRecords[j].name, namLen);
+        writer->ptr += namLen;
+        *writer->ptr++ = '=';
+        memcpy(writer->ptr, service->txtRecords[j].value, valLen);
+        writer->ptr += valLen;
+    }
+
+    if (writer->ptr == data) {
+        if (!has_room(writer, 1)) {
+            return abort_record(writer, start, numEntries);
         }
+        *writer->ptr++ = 0; // empty txt record
     }
-    *buffer++ = 0; // terminator
 
-    return buffer;
+    return finish_record(writer, data);
 }
 
-static inline char *record_header(char *buffer, char *fqdn, mdnsRecordType type, uint16_t ttl, uint16_t len) {
-    buffer = append_tokenized(buffer, fqdn);
+//
+// API
+//
+
+bool mdns_make_question(mdnsWriter *writer, const char *name, uint8_t nameLen, mdnsRecordType type) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
+
+    if (!append_name(writer, name, nameLen) || !has_room(writer, 4)) {
+        return abort_record(writer, start, numEntries);
+    }
 
     // type
-    *buffer++ = 0;
-    *buffer++ = type;
-    // class
-    *buffer++ = 0x80; // cache buster flag
-    *buffer++ = 0x01; // class: internet
-    // ttl
-    *buffer++ = ttl >> 24;
-    *buffer++ = ttl >> 16;
-    *buffer++ = ttl >> 8;
-    *buffer++ = ttl & 0xff;
-    // data length
-    *buffer++ = len >> 8;
-    *buffer++ = len & 0xff;
+    *writer->ptr++ = 0;
+    *writer->ptr++ = type;
+    // class: internet, multicast response
+    *writer->ptr++ = 0x00;
+    *writer->ptr++ = 0x01;
 
-    return buffer;
+    return true;
 }
 
-char *mdns_make_PTR(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    char *ptr = buffer;
+bool mdns_copy_question(mdnsWriter *writer, mdnsStreamBuf *buffer) {
+    uint8_t nameLen = mdns_stream_name_length(buffer);
+    if (nameLen == 0) {
+        return false;
+    }
+    if (!has_room(writer, nameLen + 4)) {
+        writer->overflow = true;
+        return false;
+    }
 
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
-        if (serviceOrNull) {
-            service = serviceOrNull; // service override
-        }
+    char *name = writer->ptr;
+    if (!mdns_stream_read_wire_name(buffer, name)) {
+        return false;
+    }
 
-        char *target = mdns_make_fqdn(hostname, service);
-        uint8_t targetLen = strlen(target);
-        char *fqdn = mdns_make_service_name(service); // _type._protocol.local
-        ptr = record_header(ptr, fqdn, mdnsRecordTypePTR, ttl, targetLen + 2 /* length header + zero byte */);
-        free(fqdn);
+    // type and class, without the unicast response bit
+    if (mdns_stream_read_bytes(buffer, name + nameLen, 4) != 4) {
+        return false;
+    }
+    name[nameLen + 2] &= 0x7f;
 
-        // packet data
-        ptr = append_tokenized(ptr, target);
-        free(target);
+    remember_labels(&writer->names, name, nameLen - 1, mdns_writer_len(writer));
+    writer->ptr += nameLen + 4;
 
-        if (serviceOrNull) {
-            break; // short circuit if we only should send one service
+    return true;
+}
+
+bool mdns_make_known_answer(mdnsWriter *writer, const char *name, uint8_t nameLen, mdnsRecordType type, uint32_t ttl, const char *data, uint16_t dataLen) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
+
+    char *rdata = record_header(writer, name, nameLen, type, ttl);
+    if (rdata == NULL) {
+        return abort_record(writer, start, numEntries);
+    }
+    rdata[-8] = 0x00; // no cache buster flag, the record is not ours
+
+    if (type == mdnsRecordTypePTR) {
+        if (!append_name(writer, data, dataLen)) {
+            return abort_record(writer, start, numEntries);
+        }
+    } else {
+        if (!has_room(writer, dataLen)) {
+            return abort_record(writer, start, numEntries);
         }
+        memcpy(writer->ptr, data, dataLen);
+        writer->ptr += dataLen;
     }
 
-    return ptr;
+    return finish_record(writer, rdata);
 }
 
-char *mdns_make_SRV(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    char *ptr = buffer;
-
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
-        if (serviceOrNull) {
-            service = serviceOrNull; // service override
-        }
-        uint8_t serviceNameLen = strlen(service->name);
-
-        char *target = mdns_make_local(hostname);
-        uint8_t targetLen = strlen(target);
-        char *fqdn = mdns_make_fqdn(hostname, service); // Hostname._service._protocol.local
-        ptr = record_header(ptr, fqdn, mdnsRecordTypeSRV, ttl, targetLen + 6 + 2 /* prio, weight, port + length header + zero byte */);
-        free(fqdn);
-        
-        // prio
-        *ptr++ = 0;
-        *ptr++ = 0;
-
-        // weight
-        *ptr++ = 0;
-        *ptr++ = 0;
-
-        // port
-        *ptr++ = service->port >> 8;
-        *ptr++ = service->port & 0xff; 
-
-        // target
-        ptr = append_tokenized(ptr, target);
-        free(target);
+bool mdns_make_PTR(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull) {
+    if (serviceOrNull) {
+        return make_PTR(writer, ttl, serviceOrNull);
+    }
 
-        if (serviceOrNull) {
-            break; // short circuit if we only should send one service
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        if (!make_PTR(writer, ttl, handle->services[i])) {
+            return false;
         }
     }
 
-    return ptr;
+    return true;
 }
 
-char *mdns_make_TXT(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull) {
-    char *ptr = buffer;
+bool mdns_make_SRV(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull) {
+    if (serviceOrNull) {
+        return make_SRV(writer, ttl, handle, serviceOrNull);
+    }
 
-    // Hostname._servicetype._protocol.local
-    for (uint8_t i = 0; i < numServices; i++) {
-        mdnsService *service = services[i];
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        if (!make_SRV(writer, ttl, handle, handle->services[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
 
+bool mdns_make_TXT(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull) {
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        mdnsService *service = handle->services[i];
         if (serviceOrNull) {
             service = serviceOrNull; // service override
         }
 
-        if (service->numTxtRecords > 0) {
-            uint8_t txtLen = 0;
-            for(uint8_t j = 0; j < service->numTxtRecords; j++) {
-                txtLen += 1 /* len of txt record k/v pair */;
-                txtLen += strlen(service->txtRecords[j].name) + 1 /* = */;
-                txtLen += strlen(service->txtRecords[j].value);
-            }
-            if (txtLen == 0) {
-                txtLen = 1; // NULL byte sentinel at least
-            }
-
-            char *fqdn = mdns_make_fqdn(hostname, service); // Servicename._type._protocol.local
-            ptr = record_header(ptr, fqdn, mdnsRecordTypeTXT, ttl, txtLen);
-            free(fqdn);
-
-            for(uint8_t j = 0; j < service->numTxtRecords; j++) {
-                uint8_t namLen = strlen(service->txtRecords[j].name);
-                uint8_t valLen = strlen(service->txtRecords[j].value);
-                *ptr++ = namLen + 1 + valLen;
-                memcpy(ptr, service->txtRecords[j].name, namLen);
-                ptr += namLen;
-                *ptr++ = '=';
-                memcpy(ptr, service->txtRecords[j].value, valLen);
-                ptr += valLen;                    
-            }
-
-            if (txtLen == 0) {
-                *ptr++ = 0; // empty txt record
-            }
+        if (mdns_service_has_txt(service) && !make_TXT(writer, ttl, service)) {
+            return false;
         }
 
         if (serviceOrNull) {
@@ -310,41 +339,45 @@ char *mdns_make_TXT(char *buffer, uint16_t ttl, char *hostname, mdnsService **se
         }
     }
 
-    return ptr;
+    return true;
 }
 
-char *mdns_make_A(char *buffer, uint16_t ttl, char *hostname, ip_address_t ip) {
-    char *ptr = buffer;
+bool mdns_make_A(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle) {
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
 
     // fqdn
-    char *fqdn = mdns_make_local(hostname);
-    ptr = record_header(ptr, fqdn, mdnsRecordTypeA, ttl, 4);
-    free(fqdn);
+    char *data = record_header(writer, handle->localName, handle->localNameLen, mdnsRecordTypeA, ttl);
+    if ((data == NULL) || !has_room(writer, 4)) {
+        return abort_record(writer, start, numEntries);
+    }
 
     // ip address
-    memcpy(ptr, &ip, 4);
-    ptr += 4;
+    memcpy(writer->ptr, &handle->ip, 4);
+    writer->ptr += 4;
 
-    return ptr;
+    return finish_record(writer, data);
 }
 
-char *mdns_make_AAAA(char *buffer, uint16_t ttl, char *hostname, ip6_address_t ip) {
-    char *ptr = buffer;
-
+bool mdns_make_AAAA(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle) {
     // make sure we actually have an IPv6 address
     ip6_addr_t zero = { 0 };
-    if (memcmp(&zero, &ip, sizeof(ip6_addr_t)) == 0) {
-        return ptr;
+    if (memcmp(&zero, &handle->ip6, sizeof(ip6_addr_t)) == 0) {
+        return true;
     }
 
+    char *start = writer->ptr;
+    uint8_t numEntries = writer->names.numEntries;
+
     // fqdn
-    char *fqdn = mdns_make_local(hostname);
-    ptr = record_header(ptr, fqdn, mdnsRecordTypeAAAA, ttl, 16);
-    free(fqdn);
+    char *data = record_header(writer, handle->localName, handle->localNameLen, mdnsRecordTypeAAAA, ttl);
+    if ((data == NULL) || !has_room(writer, 16)) {
+        return abort_record(writer, start, numEntries);
+    }
 
     // ip address
-    memcpy(ptr, &ip, 16);
-    ptr += 16;
+    memcpy(writer->ptr, &handle->ip6, 16);
+    writer->ptr += 16;
 
-    return ptr;
+    return finish_record(writer, data);
 }
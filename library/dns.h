@@ -3,6 +3,7 @@
 
 #include <mdns/mdns.h>
 #include <stdbool.h>
+#include "stream.h"
 
 typedef enum _mdnsResponseCode {
     responseCodeNoError = 0,
@@ -50,16 +51,69 @@ typedef enum _mdnsRecordType {
     mdnsRecordTypeAny = 0xff // Officially this is deceprated
 } mdnsRecordType;
 
-uint16_t mdns_sizeof_PTR(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-uint16_t mdns_sizeof_SRV(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-uint16_t mdns_sizeof_TXT(char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-uint16_t mdns_sizeof_A(char *hostname);
-uint16_t mdns_sizeof_AAAA(char *hostname, ip6_address_t ip);
-
-char *mdns_make_PTR(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-char *mdns_make_SRV(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-char *mdns_make_TXT(char *buffer, uint16_t ttl, char *hostname, mdnsService **services, uint8_t numServices, mdnsService *serviceOrNull);
-char *mdns_make_A(char *buffer, uint16_t ttl, char *hostname, ip_address_t ip);
-char *mdns_make_AAAA(char *buffer, uint16_t ttl, char *hostname, ip6_address_t ip);
+// Maximum number of labels remembered for name compression per packet
+#ifndef MDNS_NAME_TABLE_SIZE
+#define MDNS_NAME_TABLE_SIZE 24
+#endif
+
+// Name compression table (RFC 1035 section 4.1.4), one per packet
+typedef struct _mdnsNameTable {
+    // labels already in the packet
+    struct {
+        const char *suffix; // wire format name starting with this label, not owned
+        uint16_t offset;    // offset of the label in the packet
+    } entries[MDNS_NAME_TABLE_SIZE];
+    uint8_t numEntries;
+} mdnsNameTable;
+
+// Bounded packet writer, serializes records directly into a send buffer
+typedef struct _mdnsWriter {
+    char *packet; // start of the packet
+    char *ptr;    // write position
+    char *end;    // end of the buffer
+
+    // set if a record did not fit, the packet then ends with the last complete record
+    bool overflow;
+
+    // number of complete records written
+    uint16_t numRecords;
+
+    // set the cache flush bit on our records, cleared for legacy unicast responses
+    bool cacheFlush;
+
+    // compression state of the packet
+    mdnsNameTable names;
+} mdnsWriter;
+
+// start writing a packet into buffer
+void mdns_writer_init(mdnsWriter *writer, char *buffer, uint16_t size);
+
+// number of bytes written
+static inline uint16_t mdns_writer_len(mdnsWriter *writer) {
+    return writer->ptr - writer->packet;
+}
+
+// append a question, returns false if it did not fit
+bool mdns_make_question(mdnsWriter *writer, const char *name, uint8_t nameLen, mdnsRecordType type);
+
+// repeat the question at the read position of buffer (legacy unicast responses), returns false if
+// it is malformed or did not fit. The name is written uncompressed, so later records can point into it.
+bool mdns_copy_question(mdnsWriter *writer, mdnsStreamBuf *buffer);
+
+// append a received record in wire format to a query, returns false if it did not fit.
+// The data of PTR records is a name and gets compressed, both have to outlive the writer.
+bool mdns_make_known_answer(mdnsWriter *writer, const char *name, uint8_t nameLen, mdnsRecordType type, uint32_t ttl, const char *data, uint16_t dataLen);
+
+// services without TXT strings get no TXT record
+static inline bool mdns_service_has_txt(mdnsService *service) {
+    return (service->numTxtRecords > 0) || (service->declaration && (service->declaration->txtLen > 0));
+}
+
+// append records, returns false if a record did not fit (only complete records are written)
+bool mdns_make_PTR(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull);
+bool mdns_make_SRV(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull);
+bool mdns_make_TXT(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull);
+bool mdns_make_A(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle);
+bool mdns_make_AAAA(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle);
 
 #endif /* mdns_dns_h_included */
\ No newline at end of file
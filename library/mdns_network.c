@@ -10,35 +10,41 @@
 void mdns_parse_packet(mdnsHandle *handle, mdnsStreamBuf *buffer, ip_addr_t *ip, uint16_t port) {
     uint16_t transactionID = mdns_stream_read16(buffer);
     uint16_t flagsTmp = mdns_stream_read16(buffer);
+    uint8_t flagBytes[2] = { flagsTmp >> 8, flagsTmp & 0xff }; // wire order, like the writer
     mdnsPacketFlags flags;
-    memcpy(&flags, &flagsTmp, 2);
+    memcpy(&flags, flagBytes, 2);
 
     // MDNS only supports opCode 0 -> query, and non-error response codes
     if ((flags.opCode != opCodeQuery) || (flags.responseCode != responseCodeNoError)) {
-        mdns_stream_destroy(buffer);
         return;
     }
 
     uint16_t numQuestions = mdns_stream_read16(buffer);
     uint16_t numAnswers = mdns_stream_read16(buffer);
-    uint16_t numAuthorityRR = mdns_stream_read16(buffer);
+    mdns_stream_read16(buffer); // authority records are only used for probing, which we do not do
     uint16_t numAdditionalRR = mdns_stream_read16(buffer);
 
     // MDNS Answer flag set -> read answers
     if (flags.isResponse) {
+#if defined(MDNS_ENABLE_PUBLISH) && MDNS_ENABLE_PUBLISH
+        // other responders may answer with our records, so we do not have to
+        uint16_t answerOffset = mdns_stream_tell(buffer);
+        mdns_parse_response(handle, buffer, numAnswers + numAdditionalRR);
+        mdns_stream_seek(buffer, answerOffset);
+#endif /* MDNS_ENABLE_PUBLISH */
 #if defined(MDNS_ENABLE_QUERY) && MDNS_ENABLE_QUERY
         // Read answers, additional sideloaded records will be appended after the answer
         // so we can parse them with one parser
         if (handle->numQueries > 0) {
             // only waste the processing power if we have outstanding queries actually
-            mdns_parse_answers(buffer, numAnswers + numAdditionalRR);
+            mdns_parse_answers(handle, buffer, numAnswers + numAdditionalRR);
         }
 #endif /* MDNS_ENABLE_QUERY */
     } else {
 #if defined(MDNS_ENABLE_PUBLISH) && MDNS_ENABLE_PUBLISH
         // we have to listen to queries all the time as a host may have missed our
         // announce packet.
-        mdns_parse_query(handle, buffer, numQuestions, transactionID);
+        mdns_parse_query(handle, buffer, numQuestions, numAnswers, transactionID, flags.isTruncated, ip, port);
 #endif /* MDNS_ENABLE_PUBLISH */
     }
 }
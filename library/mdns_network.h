@@ -1,4 +1,6 @@
 #ifndef mdns_mdns_impl_h_included
+#define mdns_mdns_impl_h_included
+
 #include <mdns/mdns.h>
 
 #include "platform.h"
@@ -8,6 +10,49 @@
 #define MDNS_MULTICAST_ADDR 0xfb0000e0
 #define MDNS_MULTICAST_TTL 60 /* seconds */
 #define MDNS_PORT 5353
+#define MDNS_RATE_LIMIT_INTERVAL 1000 /* ms, minimum time between multicasts of a record */
+
+// random response delays in ms (RFC 6762 sections 6 and 7.2)
+#define MDNS_RESPONSE_DELAY_MIN 20
+#define MDNS_RESPONSE_DELAY_MAX 120
+#define MDNS_TRUNCATED_DELAY_MIN 400
+#define MDNS_TRUNCATED_DELAY_MAX 500
+
+// TTL of records in responses to legacy unicast queries in seconds (RFC 6762 section 6.7)
+#define MDNS_LEGACY_UNICAST_TTL 10
+
+// announcements after start or change, the first follow-up comes after MDNS_ANNOUNCE_INTERVAL ms
+// and the interval doubles with every announcement (RFC 6762 section 8.3 allows up to 8)
+#ifndef MDNS_NUM_ANNOUNCEMENTS
+#define MDNS_NUM_ANNOUNCEMENTS 2
+#endif
+#define MDNS_ANNOUNCE_INTERVAL 1000
+
+// ms the first announcement waits, so services added one after another share it
+#ifndef MDNS_ANNOUNCE_DELAY
+#define MDNS_ANNOUNCE_DELAY 20
+#endif
+
+// re-announce interval in ms if we can not answer queries
+#define MDNS_BROADCAST_INTERVAL 30000
+
+// continuous queries: random delay before the first query, then the interval doubles
+// from MDNS_QUERY_INTERVAL_MIN up to MDNS_QUERY_INTERVAL_MAX ms (RFC 6762 section 5.2)
+#define MDNS_QUERY_DELAY_MIN 20
+#define MDNS_QUERY_DELAY_MAX 120
+#define MDNS_QUERY_INTERVAL_MIN 1000
+#define MDNS_QUERY_INTERVAL_MAX (60 * 60 * 1000)
+
+// a due query waits up to this many ms for other queries to share a packet
+#define MDNS_QUERY_AGGREGATION_WINDOW 1000
+
+// Maximum size of a packet we send (Ethernet MTU minus IP and UDP headers, with some room for options)
+#ifndef MDNS_MAX_PACKET_SIZE
+#define MDNS_MAX_PACKET_SIZE 1440
+#endif
+
+// platform specific buffer for outgoing packets
+typedef struct _mdnsSendBuffer mdnsSendBuffer;
 
 //
 // Network related (this is implemented in libplatform)
@@ -25,8 +70,23 @@ mdnsUDPHandle *mdns_listen(mdnsHandle *handle);
 // stop listening
 void mdns_shutdown_socket(mdnsUDPHandle *pcb);
 
-// parse and dispatch a packet (implemented here)
+// get a send buffer with room for maxLen bytes, returns the payload to write to or NULL if out of memory
+char *mdns_send_buffer_acquire(mdnsSendBuffer *buffer, uint16_t maxLen);
+
+// shrink the send buffer to len bytes, send it to the multicast group and release it (len zero just releases it)
+void mdns_send_buffer_commit(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len);
+
 #if !MDNS_BROADCAST_ONLY
+// like mdns_send_buffer_commit but sends the packet to ip and port only
+void mdns_send_buffer_commit_to(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len, ip_addr_t *ip, uint16_t port);
+
+// release a received packet
+void mdns_network_buffer_free(mdnsNetworkBuffer *packet);
+
+// hand a received packet to the MDNS task, takes ownership of the packet (implemented here)
+void mdns_receive_packet(mdnsHandle *handle, mdnsNetworkBuffer *packet, ip_addr_t *ip, uint16_t port);
+
+// parse and dispatch a packet (implemented here)
 void mdns_parse_packet(mdnsHandle *handle, mdnsStreamBuf *buffer, ip_addr_t *ip, uint16_t port);
 #endif /* !MDNS_BROADCAST_ONLY */
 
@@ -8,6 +8,8 @@
 #include "server.h"
 #include "tools.h" // deceprated
 #include "dns.h"
+#include "response_cache.h"
+#include "service_index.h"
 
 #include "debug.h"
 
@@ -17,34 +19,9 @@
 
 #if MDNS_ENABLE_PUBLISH
 
-static uint16_t mdns_calculate_size(mdnsHandle *handle, mdnsRecordType query, mdnsService *serviceOrNull) {
-    uint8_t hostnameLen = strlen(handle->hostname);
-    uint16_t size = 12; // header
-
-    switch (query) {
-        case mdnsRecordTypePTR:
-            size += mdns_sizeof_PTR(handle->hostname, handle->services, handle->numServices, serviceOrNull);
-        case mdnsRecordTypeSRV:
-            size += mdns_sizeof_SRV(handle->hostname, handle->services, handle->numServices, serviceOrNull);
-        case mdnsRecordTypeTXT:
-            size += mdns_sizeof_TXT(handle->hostname, handle->services, handle->numServices, serviceOrNull);
-        case mdnsRecordTypeA:
-            size += mdns_sizeof_A(handle->hostname);
-        case mdnsRecordTypeAAAA:
-            size += mdns_sizeof_AAAA(handle->hostname, handle->ip6);
-            break;
-    }
-
-    // LOG(TRACE, "mdns: Calculated packet size: %d", size);
-    return size;
-}
-
-static char *mdns_prepare_response(mdnsHandle *handle, mdnsRecordType query, uint16_t ttl, uint16_t transactionID, uint16_t *len, mdnsService *serviceOrNull) {
-    uint8_t hostnameLen = strlen(handle->hostname);
-    uint16_t size = mdns_calculate_size(handle, query, serviceOrNull);
-    char *buffer = calloc(size, 1);
-    char *ptr = buffer;
-    *len = size;
+// write the response header, record counts are filled in by set_record_counts
+static void write_header(mdnsWriter *writer, uint16_t transactionID) {
+    char *ptr = writer->ptr;
 
     // transaction ID
     *ptr++ = transactionID >> 8;
@@ -60,72 +37,889 @@ static char *mdns_prepare_response(mdnsHandle *handle, mdnsRecordType query, uin
     memcpy(ptr, &flags, 2);
     ptr += 2;
 
+    // record counts
+    memset(ptr, 0, 8);
+    writer->ptr = ptr + 8;
+}
+
+static void set_record_counts(mdnsWriter *writer, uint16_t numAnswers, uint16_t numAdditionals) {
+    char *ptr = writer->packet + 4;
+
     // num questions (zero)
     *ptr++ = 0;  *ptr++ = 0;
 
-    // num answers (one), we have at least the A record
-    *ptr++ = 0;  *ptr++ = 1;
+    // num answers
+    *ptr++ = numAnswers >> 8;  *ptr++ = numAnswers & 0xff;
 
     // num authority RRs (zero)
     *ptr++ = 0;  *ptr++ = 0;
 
-    // num Additional RRs
-    // FIXME: update number of records afterwards, not here
-    uint8_t numRRs = 0;
-    switch (query) {
-        case mdnsRecordTypePTR:
-            numRRs += handle->numServices;
-        case mdnsRecordTypeSRV:
-            numRRs += handle->numServices;
-        case mdnsRecordTypeTXT:
-            for (uint8_t i = 0; i < handle->numServices; i++) {
-                if (handle->services[i]->numTxtRecords > 0) {
-                    numRRs ++; // one per service
+    // num additional RRs
+    *ptr++ = numAdditionals >> 8;  *ptr++ = numAdditionals & 0xff;
+}
+
+// records of a service or the host, ordered like the response cascade
+#define MDNS_RECORD_PTR  0x01
+#define MDNS_RECORD_SRV  0x02
+#define MDNS_RECORD_TXT  0x04
+#define MDNS_RECORD_A    0x08
+#define MDNS_RECORD_AAAA 0x10
+
+#define MDNS_RECORDS_SERVICE (MDNS_RECORD_PTR | MDNS_RECORD_SRV | MDNS_RECORD_TXT)
+#define MDNS_RECORDS_HOST (MDNS_RECORD_A | MDNS_RECORD_AAAA)
+#define MDNS_RECORDS_ALL (MDNS_RECORDS_SERVICE | MDNS_RECORDS_HOST)
+
+static bool write_record(mdnsWriter *writer, uint32_t ttl, mdnsHandle *handle, mdnsService *serviceOrNull, uint8_t record) {
+    switch (record) {
+        case MDNS_RECORD_PTR:
+            return mdns_make_PTR(writer, ttl, handle, serviceOrNull);
+        case MDNS_RECORD_SRV:
+            return mdns_make_SRV(writer, ttl, handle, serviceOrNull);
+        case MDNS_RECORD_TXT:
+            return mdns_make_TXT(writer, ttl, handle, serviceOrNull);
+        case MDNS_RECORD_A:
+            return mdns_make_A(writer, ttl, handle);
+        case MDNS_RECORD_AAAA:
+            return mdns_make_AAAA(writer, ttl, handle);
+    }
+    return true;
+}
+
+// position in the response cascade, so a response can continue in the next packet
+typedef struct _mdnsCascade {
+    uint8_t record;  // record bit to write next
+    uint8_t service; // index of the next service if the records of all services are written
+    bool marked;     // only write services marked for announcement
+} mdnsCascade;
+
+// record bit of a query type
+static uint8_t record_bit(mdnsRecordType type) {
+    switch (type) {
+        case mdnsRecordTypePTR:  return MDNS_RECORD_PTR;
+        case mdnsRecordTypeSRV:  return MDNS_RECORD_SRV;
+        case mdnsRecordTypeTXT:  return MDNS_RECORD_TXT;
+        case mdnsRecordTypeA:    return MDNS_RECORD_A;
+        case mdnsRecordTypeAAAA: return MDNS_RECORD_AAAA;
+        default:                 return 0;
+    }
+}
+
+// serialize the next packet of a response into buffer, whole records are moved to the next packet
+// if they do not fit. Returns the length of the packet or zero if there is nothing left to write.
+static uint16_t mdns_prepare_response(mdnsHandle *handle, char *buffer, uint16_t size, uint8_t answer, uint8_t records, uint32_t ttl, uint16_t transactionID, mdnsService *serviceOrNull, mdnsCascade *cascade) {
+    mdnsWriter writer;
+    mdns_writer_init(&writer, buffer, size);
+    write_header(&writer, transactionID);
+
+    uint16_t numAnswers = 0;
+    while (cascade->record & MDNS_RECORDS_ALL) {
+        uint8_t record = cascade->record;
+        mdnsService *service = serviceOrNull;
+
+        // service records are written one service at a time
+        if (!(records & record) || ((record & MDNS_RECORDS_SERVICE) && !serviceOrNull)) {
+            if (!(records & record) || (cascade->service >= handle->numServices)) {
+                cascade->record <<= 1;
+                cascade->service = 0;
+                continue;
+            }
+            service = handle->services[cascade->service];
+            if (cascade->marked && !service->announce) {
+                cascade->service++;
+                continue;
+            }
+        }
+
+        if (!write_record(&writer, ttl, handle, service, record)) {
+            if (writer.numRecords > 0) {
+                break; // continue in the next packet
+            }
+            LOG(ERROR, "mdns: record %02x does not fit into a packet, skipping", record);
+        } else if (record == answer) {
+            numAnswers = writer.numRecords;
+        }
+
+        if (service != serviceOrNull) {
+            cascade->service++;
+        } else {
+            cascade->record <<= 1;
+        }
+    }
+
+    if (writer.numRecords == 0) {
+        return 0;
+    }
+
+    // the records of the queried type are answers, the others are additional RRs
+    set_record_counts(&writer, numAnswers, writer.numRecords - numAnswers);
+
+    return mdns_writer_len(&writer);
+}
+
+// send a finished packet to the multicast group or by unicast if ipOrNull is set
+static void commit_packet(mdnsHandle *handle, mdnsSendBuffer *send, uint16_t len, ip_addr_t *ipOrNull, uint16_t port) {
+#if !MDNS_BROADCAST_ONLY
+    if (ipOrNull) {
+        mdns_send_buffer_commit_to(handle, send, len, ipOrNull, port);
+        return;
+    }
+#endif
+    mdns_send_buffer_commit(handle, send, len);
+}
+
+// send the response cascade starting at query, limited to the records in the records mask.
+// Only complete cascades are cached. Sent to the multicast group if ipOrNull is NULL.
+static void send_mdns_response_packet(mdnsHandle *handle, mdnsRecordType query, uint8_t records, uint32_t ttl, uint16_t transactionID, mdnsService *serviceOrNull, ip_addr_t *ipOrNull, uint16_t port) {
+    mdnsSendBuffer send;
+    bool cacheable = (records == MDNS_RECORDS_ALL);
+    mdnsCachedResponse *response = cacheable ? mdns_response_cache_lookup(handle, query, serviceOrNull) : NULL;
+
+    if (response) {
+        // copy the pre-serialized response into the send buffer
+        char *buffer = mdns_send_buffer_acquire(&send, response->len);
+        if (buffer == NULL) {
+            return;
+        }
+        mdns_response_cache_patch(response, transactionID, ttl);
+        memcpy(buffer, response->data, response->len);
+        commit_packet(handle, &send, response->len, ipOrNull, port);
+        return;
+    }
+
+    // serialize directly into the send buffers, as many packets as needed
+    mdnsCascade cascade = { record_bit(query), 0, false };
+    bool first = true;
+    while (true) {
+        char *buffer = mdns_send_buffer_acquire(&send, MDNS_MAX_PACKET_SIZE);
+        if (buffer == NULL) {
+            return;
+        }
+        uint16_t len = mdns_prepare_response(handle, buffer, MDNS_MAX_PACKET_SIZE, record_bit(query), records, ttl, transactionID, serviceOrNull, &cascade);
+        bool complete = !(cascade.record & MDNS_RECORDS_ALL);
+
+        // keep a copy for the next time, only responses that fit into one packet are cached
+        if (cacheable && first && complete && (len > 0)) {
+            mdns_response_cache_insert(handle, query, serviceOrNull, buffer, len);
+        }
+        commit_packet(handle, &send, len, ipOrNull, port);
+
+        if (complete || (len == 0)) {
+            return;
+        }
+        first = false;
+    }
+}
+
+//
+// API
+//
+
+#if !MDNS_BROADCAST_ONLY
+
+// what a question name refers to
+typedef enum _mdnsNameMatch {
+    mdnsNameMatchNone = 0,
+    mdnsNameMatchHost,           // hostname.local
+    mdnsNameMatchServiceType,    // _type._protocol.local
+    mdnsNameMatchServiceInstance // hostname._type._protocol.local
+} mdnsNameMatch;
+
+// find the service for the service label at offset in the index, compares the label in place.
+// The hostname has already been verified for instance names.
+static mdnsService *find_service(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t offset, uint8_t len, uint32_t hash, mdnsProtocol protocol, bool instance) {
+    mdnsService *service = NULL;
+
+    if (instance) {
+        uint32_t key = mdns_service_instance_key(handle->hostnameHash, hash, protocol);
+        while ((service = mdns_service_index_find_instance(handle, key, service)) != NULL) {
+            if ((service->nameLen == len) && (service->protocol == protocol) && mdns_stream_match_label(buffer, offset, service->name, len)) {
+                return service;
+            }
+        }
+    } else {
+        uint32_t key = mdns_service_type_key(hash, protocol);
+        while ((service = mdns_service_index_find_type(handle, key, service)) != NULL) {
+            if ((service->nameLen == len) && (service->protocol == protocol) && mdns_stream_match_label(buffer, offset, service->name, len)) {
+                return service;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// match the question name at the read position against our names in one pass,
+// labels are hashed while streaming and the name is rejected at the first label that
+// can not be one of ours. Moves the read position behind the name.
+static mdnsNameMatch match_question_name(mdnsHandle *handle, mdnsStreamBuf *buffer, mdnsService **service) {
+    enum {
+        expectHostOrType,
+        expectLocalOrType,
+        expectProtocol,
+        expectLocal,
+        expectEnd
+    } expect = expectHostOrType;
+
+    mdnsNameIterator iterator;
+    mdns_name_iterator_init(&iterator, buffer);
+
+    bool host = false;
+    uint16_t hostOffset = 0;
+    uint16_t typeOffset = 0;
+    uint8_t typeLen = 0;
+    uint32_t typeHash = 0;
+    mdnsProtocol protocol = mdnsProtocolTCP;
+
+    while (true) {
+        int16_t len = mdns_name_iterator_next(&iterator);
+        if (len <= 0) {
+            if ((len < 0) || (expect != expectEnd)) {
+                host = false;
+                typeLen = 0;
+            }
+            break;
+        }
+
+        uint16_t offset = mdns_stream_tell(buffer);
+        uint32_t hash = mdns_stream_hash_label(buffer, len);
+        bool rejected = false;
+
+        switch (expect) {
+            case expectHostOrType:
+                if ((len == handle->hostnameLen) && (hash == handle->hostnameHash)) {
+                    host = true;
+                    hostOffset = offset;
+                    expect = expectLocalOrType;
+                    break;
                 }
+                // fallthrough
+
+            case expectLocalOrType:
+                if (host && (len == 5) && (hash == MDNS_HASH_LOCAL)) {
+                    expect = expectEnd;
+                    break;
+                }
+                typeOffset = offset;
+                typeLen = len;
+                typeHash = hash;
+                expect = expectProtocol;
+                break;
+
+            case expectProtocol:
+                if ((len == 4) && (hash == MDNS_HASH_TCP)) {
+                    protocol = mdnsProtocolTCP;
+                } else if ((len == 4) && (hash == MDNS_HASH_UDP)) {
+                    protocol = mdnsProtocolUDP;
+                } else {
+                    rejected = true;
+                }
+                expect = expectLocal;
+                break;
+
+            case expectLocal:
+                rejected = (len != 5) || (hash != MDNS_HASH_LOCAL);
+                expect = expectEnd;
+                break;
+
+            case expectEnd:
+                rejected = true;
+                break;
+        }
+
+        if (rejected) {
+            host = false;
+            typeLen = 0;
+            break;
+        }
+    }
+
+    // move behind the name, the comparisons below jump back into it
+    if (!mdns_name_iterator_finish(&iterator)) {
+        return mdnsNameMatchNone;
+    }
+    uint16_t position = mdns_stream_tell(buffer);
+    mdnsNameMatch result = mdnsNameMatchNone;
+
+    // hashes matched, now verify the labels byte by byte
+    if (host && !mdns_stream_match_label(buffer, hostOffset, handle->hostname, handle->hostnameLen)) {
+        host = false;
+        typeLen = 0; // instance names always start with our hostname
+    }
+    if (typeLen > 0) {
+        *service = find_service(handle, buffer, typeOffset, typeLen, typeHash, protocol, host);
+        if (*service) {
+            result = host ? mdnsNameMatchServiceInstance : mdnsNameMatchServiceType;
+        }
+    } else if (host) {
+        result = mdnsNameMatchHost;
+    }
+
+    mdns_stream_seek(buffer, position);
+    return result;
+}
+
+// time a record was multicast the last time, zero if never
+static uint32_t *last_multicast(mdnsHandle *handle, mdnsService *serviceOrNull, uint8_t record) {
+    switch (record) {
+        case MDNS_RECORD_PTR:  return &serviceOrNull->lastMulticast[0];
+        case MDNS_RECORD_SRV:  return &serviceOrNull->lastMulticast[1];
+        case MDNS_RECORD_TXT:  return &serviceOrNull->lastMulticast[2];
+        case MDNS_RECORD_A:    return &handle->lastMulticast[0];
+        default:               return &handle->lastMulticast[1];
+    }
+}
+
+// current time for the multicast table, zero is reserved for never
+static inline uint32_t multicast_time(void) {
+    uint32_t now = mdns_now();
+    return (now == 0) ? 1 : now;
+}
+
+// remember that the records were just multicast (by us or another responder)
+static void mark_multicast(mdnsHandle *handle, mdnsService *serviceOrNull, uint8_t records) {
+    uint32_t now = multicast_time();
+
+    for (uint8_t record = MDNS_RECORD_PTR; record <= MDNS_RECORD_AAAA; record <<= 1) {
+        if ((records & record) && (serviceOrNull || (record & MDNS_RECORDS_HOST))) {
+            *last_multicast(handle, serviceOrNull, record) = now;
+        }
+    }
+}
+
+// records that have been multicast within the last interval ms
+static uint8_t multicast_within(mdnsHandle *handle, mdnsService *serviceOrNull, uint8_t records, uint32_t interval) {
+    uint32_t now = multicast_time();
+    uint8_t result = 0;
+
+    for (uint8_t record = MDNS_RECORD_PTR; record <= MDNS_RECORD_AAAA; record <<= 1) {
+        if (!(records & record)) {
+            continue;
+        }
+        uint32_t last = *last_multicast(handle, serviceOrNull, record);
+        if ((last != 0) && (now - last < interval)) {
+            result |= record;
+        }
+    }
+
+    return result;
+}
+
+static void response_init(mdnsResponse *response, mdnsHandle *handle, uint16_t transactionID) {
+    memset(response, 0, sizeof(mdnsResponse));
+    response->handle = handle;
+    response->transactionID = transactionID;
+
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        handle->services[i]->queuedAnswers = 0;
+        handle->services[i]->queuedAdditionals = 0;
+    }
+}
+
+// queue answers, everything later in the cascade is queued as additional records
+static void response_add_answers(mdnsResponse *response, mdnsService *serviceOrNull, uint8_t answers) {
+    uint8_t additionals = ~(answers | ((answers & -answers) - 1)) & MDNS_RECORDS_ALL;
+
+    if (serviceOrNull) {
+        serviceOrNull->queuedAnswers |= answers & MDNS_RECORDS_SERVICE;
+        serviceOrNull->queuedAdditionals |= additionals & MDNS_RECORDS_SERVICE;
+    }
+    response->hostAnswers |= answers & MDNS_RECORDS_HOST;
+    response->hostAdditionals |= additionals & MDNS_RECORDS_HOST;
+
+    if ((response->numAnswerSets == 0) || (response->lastAnswers != answers) || (response->lastService != serviceOrNull)) {
+        response->numAnswerSets++;
+        response->lastAnswers = answers;
+        response->lastService = serviceOrNull;
+    }
+}
+
+static bool begin_packet(mdnsResponse *response, mdnsSendBuffer *send, mdnsWriter *writer) {
+    char *buffer = mdns_send_buffer_acquire(send, MDNS_MAX_PACKET_SIZE);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    mdns_writer_init(writer, buffer, MDNS_MAX_PACKET_SIZE);
+    write_header(writer, response->transactionID);
+    return true;
+}
+
+static void finish_packet(mdnsResponse *response, mdnsSendBuffer *send, mdnsWriter *writer, uint16_t numAnswers) {
+    if (writer->numRecords == 0) {
+        mdns_send_buffer_commit(response->handle, send, 0); // nothing to send
+        return;
+    }
+
+    set_record_counts(writer, numAnswers, writer->numRecords - numAnswers);
+    mdns_send_buffer_commit(response->handle, send, mdns_writer_len(writer));
+}
+
+// write all queued answers, starting a new packet when the current one is full
+static bool write_answers(mdnsResponse *response, mdnsSendBuffer *send, mdnsWriter *writer, uint32_t ttl, mdnsService *serviceOrNull, uint8_t answers) {
+    for (uint8_t record = MDNS_RECORD_PTR; record <= MDNS_RECORD_AAAA; record <<= 1) {
+        if (!(answers & record) || write_record(writer, ttl, response->handle, serviceOrNull, record)) {
+            continue;
+        }
+        if (writer->numRecords == 0) {
+            continue; // does not even fit into an empty packet
+        }
+
+        // packet is full, all records in it are answers
+        finish_packet(response, send, writer, writer->numRecords);
+        if (!begin_packet(response, send, writer)) {
+            return false;
+        }
+        write_record(writer, ttl, response->handle, serviceOrNull, record);
+    }
+    return true;
+}
+
+// write queued additional records as long as they fit into the last packet
+static void write_additionals(mdnsResponse *response, mdnsWriter *writer, uint32_t ttl, mdnsService *serviceOrNull, uint8_t additionals) {
+    for (uint8_t record = MDNS_RECORD_PTR; record <= MDNS_RECORD_AAAA; record <<= 1) {
+        if ((additionals & record) && !write_record(writer, ttl, response->handle, serviceOrNull, record)) {
+            return;
+        }
+    }
+}
+
+// send all queued records, answers first, then the additional records that are not answers already
+static void response_send(mdnsResponse *response, uint32_t ttl) {
+    mdnsHandle *handle = response->handle;
+
+    if (response->numAnswerSets == 0) {
+        return;
+    }
+
+    // do not multicast a record more than once per second (RFC 6762 section 6)
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        mdnsService *service = handle->services[i];
+        uint8_t throttled = multicast_within(handle, service, service->queuedAnswers | service->queuedAdditionals, MDNS_RATE_LIMIT_INTERVAL);
+        if (throttled) {
+            service->queuedAnswers &= ~throttled;
+            service->queuedAdditionals = service->queuedAnswers ? (service->queuedAdditionals & ~throttled) : 0;
+            response->suppressed = true;
+        }
+    }
+    uint8_t throttled = multicast_within(handle, NULL, response->hostAnswers | response->hostAdditionals, MDNS_RATE_LIMIT_INTERVAL);
+    if (throttled) {
+        response->hostAnswers &= ~throttled;
+        response->hostAdditionals &= ~throttled;
+        response->suppressed = true;
+    }
+
+    // nothing left to answer
+    if (response->suppressed && !response->hostAnswers) {
+        uint8_t i = 0;
+        while ((i < handle->numServices) && !handle->services[i]->queuedAnswers) {
+            i++;
+        }
+        if (i == handle->numServices) {
+            LOG(TRACE, "mdns: all answers suppressed");
+            return;
+        }
+    }
+
+    // remember what we are about to send
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        mdnsService *service = handle->services[i];
+        mark_multicast(handle, service, service->queuedAnswers | service->queuedAdditionals);
+    }
+    mark_multicast(handle, NULL, response->hostAnswers | response->hostAdditionals);
+
+    // a single question is answered by one of the pre-serialized cascades
+    if ((response->numAnswerSets == 1) && !response->suppressed) {
+        switch (response->lastAnswers) {
+            case MDNS_RECORD_PTR:
+                send_mdns_response_packet(handle, mdnsRecordTypePTR, MDNS_RECORDS_ALL, ttl, response->transactionID, response->lastService, NULL, 0);
+                return;
+            case MDNS_RECORD_SRV:
+                send_mdns_response_packet(handle, mdnsRecordTypeSRV, MDNS_RECORDS_ALL, ttl, response->transactionID, response->lastService, NULL, 0);
+                return;
+            case MDNS_RECORD_TXT:
+                send_mdns_response_packet(handle, mdnsRecordTypeTXT, MDNS_RECORDS_ALL, ttl, response->transactionID, response->lastService, NULL, 0);
+                return;
+            case MDNS_RECORD_A:
+                send_mdns_response_packet(handle, mdnsRecordTypeA, MDNS_RECORDS_ALL, ttl, response->transactionID, NULL, NULL, 0);
+                return;
+        }
+    }
+
+    mdnsSendBuffer send;
+    mdnsWriter writer;
+    if (!begin_packet(response, &send, &writer)) {
+        return;
+    }
+
+    // answers may span multiple packets
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        mdnsService *service = handle->services[i];
+        if (!write_answers(response, &send, &writer, ttl, service, service->queuedAnswers)) {
+            return;
+        }
+    }
+    if (!write_answers(response, &send, &writer, ttl, NULL, response->hostAnswers)) {
+        return;
+    }
+    uint16_t numAnswers = writer.numRecords;
+    if (numAnswers == 0) {
+        mdns_send_buffer_commit(handle, &send, 0); // everything was suppressed
+        return;
+    }
+
+    // additional records are optional, only send what fits into the last packet
+    for (uint8_t i = 0; (i < handle->numServices) && !writer.overflow; i++) {
+        mdnsService *service = handle->services[i];
+        write_additionals(response, &writer, ttl, service, service->queuedAdditionals & ~service->queuedAnswers);
+    }
+    if (!writer.overflow) {
+        write_additionals(response, &writer, ttl, NULL, response->hostAdditionals & ~response->hostAnswers);
+    }
+
+    finish_packet(response, &send, &writer, numAnswers);
+}
+
+// records that answer a question, zero if it is not for us
+static uint8_t question_answers(mdnsNameMatch match, mdnsRecordType queryType) {
+    uint8_t answers = 0;
+
+    switch(queryType) {
+        case mdnsRecordTypePTR: {
+            // PTR records are for searching for services
+            if (match == mdnsNameMatchServiceType) {
+                LOG(TRACE, "mdns: responding to PTR query");
+                answers = MDNS_RECORD_PTR;
+            }
+            break;
+        }
+
+        case mdnsRecordTypeA: {
+            // A records want to find an IP address for a hostname
+            if (match == mdnsNameMatchHost) {
+                LOG(TRACE, "mdns: responding to A query");
+                answers = MDNS_RECORD_A;
+            }
+            break;
+        }
+
+        case mdnsRecordTypeAAAA: {
+            // same for IPv6, only answered if we have an IPv6 address
+            if (match == mdnsNameMatchHost) {
+                LOG(TRACE, "mdns: responding to AAAA query");
+                answers = MDNS_RECORD_AAAA;
+            }
+            break;
+        }
+
+        case mdnsRecordTypeSRV: {
+            // only answer if the complete service name is correct
+            if (match == mdnsNameMatchServiceInstance) {
+                LOG(TRACE, "mdns: responding to SRV query");
+                answers = MDNS_RECORD_SRV;
+            }
+            break;
+        }
+
+        case mdnsRecordTypeTXT: {
+            // only answer if the complete service name is correct
+            if (match == mdnsNameMatchServiceInstance) {
+                LOG(TRACE, "mdns: responding to TXT query");
+                answers = MDNS_RECORD_TXT;
             }
-        case mdnsRecordTypeA:
-            numRRs++;
-        case mdnsRecordTypeAAAA:
-            numRRs++;
             break;
+        }
+
+        case mdnsRecordTypeAny: {
+            // This requests just everything about a name, officially deceprated but I can see it on the network
+            if (match == mdnsNameMatchHost) {
+                LOG(TRACE, "mdns: responding to ANY query");
+                answers = MDNS_RECORDS_HOST;
+            } else if (match == mdnsNameMatchServiceType) {
+                LOG(TRACE, "mdns: responding to ANY query");
+                answers = MDNS_RECORD_PTR;
+            } else if (match == mdnsNameMatchServiceInstance) {
+                LOG(TRACE, "mdns: responding to ANY query");
+                answers = MDNS_RECORD_SRV | MDNS_RECORD_TXT;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    return answers;
+}
+
+// answer a question right away with the response cascade of its first answer record,
+// unicast responses are not delayed and do not count as multicast
+static void send_unicast_answers(mdnsHandle *handle, mdnsService *serviceOrNull, uint8_t answers, uint16_t transactionID, ip_addr_t *ip, uint16_t port) {
+    mdnsRecordType query;
+
+    switch (answers & -answers) {
+        case MDNS_RECORD_PTR:  query = mdnsRecordTypePTR;  break;
+        case MDNS_RECORD_SRV:  query = mdnsRecordTypeSRV;  break;
+        case MDNS_RECORD_TXT:  query = mdnsRecordTypeTXT;  break;
+        case MDNS_RECORD_A:    query = mdnsRecordTypeA;    break;
+        default:               query = mdnsRecordTypeAAAA; break;
+    }
+
+    send_mdns_response_packet(handle, query, MDNS_RECORDS_ALL, MDNS_MULTICAST_TTL, transactionID, serviceOrNull, ip, port);
+}
+
+// answer a query from a port other than 5353 (legacy unicast, RFC 6762 section 6.7) with one unicast
+// packet that repeats the questions, short TTLs and no cache flush bits. The querier is not part of
+// the multicast group, so the pending multicast response and the rate limits are not touched.
+static void answer_legacy_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQueries, uint16_t transactionID, ip_addr_t *ip, uint16_t port) {
+    mdnsSendBuffer send;
+    mdnsWriter writer;
+
+    char *packet = mdns_send_buffer_acquire(&send, MDNS_MAX_PACKET_SIZE);
+    if (packet == NULL) {
+        return;
+    }
+    mdns_writer_init(&writer, packet, MDNS_MAX_PACKET_SIZE);
+    writer.cacheFlush = false;
+    write_header(&writer, transactionID);
+
+    // first pass: repeat the questions, the answers can point into them
+    uint16_t questionOffset = mdns_stream_tell(buffer);
+    for (uint16_t i = 0; i < numQueries; i++) {
+        if (!mdns_copy_question(&writer, buffer)) {
+            mdns_send_buffer_commit(handle, &send, 0);
+            return;
+        }
+    }
+    uint16_t knownAnswerOffset = mdns_stream_tell(buffer);
+
+    // second pass: answers, the address records accompany service records
+    uint8_t hostAnswers = 0;
+    uint8_t hostAdditionals = 0;
+    mdns_stream_seek(buffer, questionOffset);
+    for (uint16_t i = 0; (i < numQueries) && !writer.overflow; i++) {
+        mdnsService *service = NULL;
+        mdnsNameMatch match = match_question_name(handle, buffer, &service);
+        uint8_t answers = question_answers(match, mdns_stream_read16(buffer));
+        (void)mdns_stream_read16(buffer); // class
+
+        for (uint8_t record = MDNS_RECORD_PTR; record <= MDNS_RECORD_AAAA; record <<= 1) {
+            if ((answers & record) && !write_record(&writer, MDNS_LEGACY_UNICAST_TTL, handle, service, record)) {
+                break; // the querier can not ask again via TCP, so it gets what fits
+            }
+        }
+        hostAnswers |= answers & MDNS_RECORDS_HOST;
+        if (answers & (MDNS_RECORD_PTR | MDNS_RECORD_SRV)) {
+            hostAdditionals = MDNS_RECORDS_HOST;
+        }
+    }
+    mdns_stream_seek(buffer, knownAnswerOffset);
+
+    uint16_t numAnswers = writer.numRecords;
+    if (numAnswers == 0) {
+        mdns_send_buffer_commit(handle, &send, 0); // not for us
+        return;
+    }
+    for (uint8_t record = MDNS_RECORD_A; (record <= MDNS_RECORD_AAAA) && !writer.overflow; record <<= 1) {
+        if (hostAdditionals & ~hostAnswers & record) {
+            write_record(&writer, MDNS_LEGACY_UNICAST_TTL, handle, NULL, record);
+        }
+    }
+
+    set_record_counts(&writer, numAnswers, writer.numRecords - numAnswers);
+    packet[4] = numQueries >> 8;
+    packet[5] = numQueries & 0xff;
+
+    LOG(TRACE, "mdns: answering legacy unicast query");
+    mdns_send_buffer_commit_to(handle, &send, mdns_writer_len(&writer), ip, port);
+}
+
+// drop a queued record, returns false if it was not queued
+static bool response_drop(mdnsResponse *response, mdnsService *serviceOrNull, uint8_t record) {
+    uint8_t *answers = serviceOrNull ? &serviceOrNull->queuedAnswers : &response->hostAnswers;
+    uint8_t *additionals = serviceOrNull ? &serviceOrNull->queuedAdditionals : &response->hostAdditionals;
+
+    if (!((*answers | *additionals) & record)) {
+        return false;
+    }
+    *answers &= ~record;
+    *additionals &= ~record;
+    response->suppressed = true;
+
+    // additional records of a service only accompany its answers
+    if (serviceOrNull && (serviceOrNull->queuedAnswers == 0)) {
+        serviceOrNull->queuedAdditionals = 0;
+    }
+    return true;
+}
+
+// drop a queued record the querier already knows
+static void response_suppress(mdnsResponse *response, mdnsService *serviceOrNull, uint8_t record, uint16_t recordLen) {
+    if (response_drop(response, serviceOrNull, record)) {
+        // the querier sent the same record, so its length is about what we save
+        response->handle->knownAnswerSavedBytes += recordLen;
     }
-    *ptr++ = 0;
-    *ptr++ = numRRs - 1; // One is already in the answer, the others are additional RRs
+}
+
+// compare the bytes at the read position with constant data in flash, in small chunks
+static bool match_flash_bytes(mdnsStreamBuf *buffer, const void *data, uint16_t len) {
+    uint32_t chunk[8];
+    const uint16_t chunkSize = sizeof(chunk);
 
-    char *fqdn = NULL;
+    for (uint16_t offset = 0; offset < len; offset += chunkSize) {
+        uint16_t remaining = len - offset;
+        uint16_t chunkLen = (remaining > chunkSize) ? chunkSize : remaining;
+        mdns_flash_read(chunk, (const char *)data + offset, chunkLen);
+        if (!mdns_stream_match_bytes(buffer, chunk, chunkLen)) {
+            return false;
+        }
+    }
 
-    // records
-    switch (query) {
+    return true;
+}
+
+// check if the record data at the read position matches our record, returns the record bit or zero
+static uint8_t match_known_answer(mdnsHandle *handle, mdnsStreamBuf *buffer, mdnsNameMatch match, mdnsService *service, mdnsRecordType type, uint16_t dataLength) {
+    mdnsService *target = NULL;
+
+    switch (type) {
         case mdnsRecordTypePTR:
-            ptr = mdns_make_PTR(ptr, ttl, handle->hostname, handle->services, handle->numServices, serviceOrNull);
+            // _type._protocol.local -> hostname._type._protocol.local
+            if ((match == mdnsNameMatchServiceType) && (match_question_name(handle, buffer, &target) == mdnsNameMatchServiceInstance) && (target == service)) {
+                return MDNS_RECORD_PTR;
+            }
+            break;
+
         case mdnsRecordTypeSRV:
-            ptr = mdns_make_SRV(ptr, ttl, handle->hostname, handle->services, handle->numServices, serviceOrNull);
+            // prio, weight, port, target
+            if ((match == mdnsNameMatchServiceInstance) && (dataLength > 6)) {
+                mdns_stream_skip(buffer, 4);
+                if ((mdns_stream_read16(buffer) == service->port) && (match_question_name(handle, buffer, &target) == mdnsNameMatchHost)) {
+                    return MDNS_RECORD_SRV;
+                }
+            }
+            break;
+
         case mdnsRecordTypeTXT:
-            ptr = mdns_make_TXT(ptr, ttl, handle->hostname, handle->services, handle->numServices, serviceOrNull);
+            if ((match == mdnsNameMatchServiceInstance) && service->declaration) {
+                if ((dataLength == service->declaration->txtLen) && match_flash_bytes(buffer, service->declaration->txt, dataLength)) {
+                    return MDNS_RECORD_TXT;
+                }
+            } else if ((match == mdnsNameMatchServiceInstance) && (service->numTxtRecords > 0)) {
+                uint16_t len = 0;
+                for (uint8_t i = 0; i < service->numTxtRecords; i++) {
+                    uint8_t namLen = strlen(service->txtRecords[i].name);
+                    uint8_t valLen = strlen(service->txtRecords[i].value);
+                    len += 1 + namLen + 1 + valLen;
+
+                    if ((len > dataLength) || (mdns_stream_read8(buffer) != (uint8_t)(namLen + 1 + valLen))) {
+                        return 0;
+                    }
+                    if (!mdns_stream_match_bytes(buffer, service->txtRecords[i].name, namLen) || (mdns_stream_read8(buffer) != '=')) {
+                        return 0;
+                    }
+                    if (!mdns_stream_match_bytes(buffer, service->txtRecords[i].value, valLen)) {
+                        return 0;
+                    }
+                }
+                if (len == dataLength) {
+                    return MDNS_RECORD_TXT;
+                }
+            }
+            break;
+
         case mdnsRecordTypeA:
-            ptr = mdns_make_A(ptr, ttl, handle->hostname, handle->ip);
+            if ((match == mdnsNameMatchHost) && (dataLength == 4) && mdns_stream_match_bytes(buffer, &handle->ip, 4)) {
+                return MDNS_RECORD_A;
+            }
+            break;
+
         case mdnsRecordTypeAAAA:
-            ptr = mdns_make_AAAA(ptr, ttl, handle->hostname, handle->ip6);
+            if ((match == mdnsNameMatchHost) && (dataLength == 16) && mdns_stream_match_bytes(buffer, &handle->ip6, 16)) {
+                return MDNS_RECORD_AAAA;
+            }
+            break;
+
+        default:
             break;
     }
 
-    return buffer;
+    return 0;
 }
 
-static void send_mdns_response_packet(mdnsHandle *handle, uint16_t ttl, uint16_t transactionID, mdnsService *serviceOrNull) {
-    uint16_t responseLen = 0;
-    char *response;
+// read the resource record at the read position and check if it is one of ours with at least
+// half of our TTL left. Returns the record bit or zero, -1 if the packet is truncated.
+// *service is set for service records, *recordLen to the length of the record in the packet.
+static int8_t read_matching_record(mdnsHandle *handle, mdnsStreamBuf *buffer, mdnsService **service, uint16_t *recordLen) {
+    uint16_t recordOffset = mdns_stream_tell(buffer);
+    uint8_t record = 0;
+
+    *service = NULL;
+    mdnsNameMatch match = match_question_name(handle, buffer, service);
+
+    mdnsRecordType type = mdns_stream_read16(buffer);
+    (void)mdns_stream_read16(buffer); // class
+    uint32_t ttl = mdns_stream_read32(buffer);
+    uint16_t dataLength = mdns_stream_read16(buffer);
+
+    // make sure the record is complete before looking at its data
+    uint16_t dataOffset = mdns_stream_tell(buffer);
+    if (!mdns_stream_skip(buffer, dataLength)) {
+        return -1;
+    }
+    *recordLen = mdns_stream_tell(buffer) - recordOffset;
+
+    if ((match != mdnsNameMatchNone) && (ttl >= MDNS_MULTICAST_TTL / 2)) {
+        mdns_stream_seek(buffer, dataOffset);
+        record = match_known_answer(handle, buffer, match, *service, type, dataLength);
+    }
 
-    response = mdns_prepare_response(handle, mdnsRecordTypePTR, ttl, transactionID, &responseLen, serviceOrNull);
-    mdns_send_udp_packet(handle, response, responseLen);
+    mdns_stream_seek(buffer, dataOffset + dataLength);
+    if (!(record & MDNS_RECORDS_SERVICE)) {
+        *service = NULL;
+    }
+    return record;
 }
 
-//
-// API
-//
+// parse the known-answer section of a query (RFC 6762 section 7.1) and drop the
+// records the querier already has with at least half of their TTL left
+static void parse_known_answers(mdnsResponse *response, mdnsStreamBuf *buffer, uint16_t numKnownAnswers) {
+    while (numKnownAnswers--) {
+        mdnsService *service = NULL;
+        uint16_t recordLen = 0;
 
-#if !MDNS_BROADCAST_ONLY
-void mdns_parse_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQueries, uint16_t transactionID) {
+        int8_t record = read_matching_record(response->handle, buffer, &service, &recordLen);
+        if (record < 0) {
+            return;
+        }
+        if (record > 0) {
+            LOG(TRACE, "mdns: suppressing known answer %02x", record);
+            response_suppress(response, service, record, recordLen);
+        }
+    }
+}
+
+void mdns_parse_response(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numRecords) {
+    // another responder multicast some of our records, if they are identical
+    // to ours we can skip answering them for a second (RFC 6762 section 7.4)
+    while (numRecords--) {
+        mdnsService *service = NULL;
+        uint16_t recordLen = 0;
+
+        int8_t record = read_matching_record(handle, buffer, &service, &recordLen);
+        if (record < 0) {
+            return;
+        }
+        if (record > 0) {
+            LOG(TRACE, "mdns: record %02x was answered by another responder", record);
+            mark_multicast(handle, service, record);
+            if (handle->response.pending) {
+                response_drop(&handle->response, service, record);
+            }
+        }
+    }
+}
+
+void mdns_parse_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQueries, uint16_t numKnownAnswers, uint16_t transactionID, bool truncated, ip_addr_t *ip, uint16_t port) {
     // we have to react to:
     // - domain name queries
     // - service discovery queries to one of our registered service types
@@ -134,119 +928,169 @@ void mdns_parse_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQue
 
     LOG(TRACE, "mdns: parsing %d queries", numQueries);
 
-    char *serviceName[4];
+    // simple resolvers query from other ports and expect a direct answer
+    if (ip && (port != MDNS_PORT)) {
+        answer_legacy_query(handle, buffer, numQueries, transactionID, ip, port);
+        return;
+    }
 
-    while (numQueries--) {
-        // Read FQDN
-        uint8_t stringsRead = 0;
-        do {
-            uint8_t len = mdns_stream_read8(buffer);
-            if (len & 0xC0) { // Compressed pointer (not supported)
-                (void)mdns_stream_read8(buffer);
-                break;
-            }
-            if (len == 0x00) { // End of name
-                break;
-            }
-            if (stringsRead > 4) {
-                return;
-            }
-            serviceName[stringsRead] = mdns_stream_read_string(buffer, len);
-            stringsRead++;
-        } while (true);
+    // answers are collected until the response is sent, a pending
+    // response picks up the answers of this packet too
+    mdnsResponse *response = &handle->response;
+    if (!response->pending) {
+        response_init(response, handle, transactionID);
+    }
+    uint8_t numAnswerSets = response->numAnswerSets;
 
+    // known answers of this or the next packets can only suppress the multicast response
+    bool unicast = (ip != NULL) && (numKnownAnswers == 0) && !truncated;
+
+    while (numQueries--) {
+        mdnsService *service = NULL;
+        mdnsNameMatch match = match_question_name(handle, buffer, &service);
 
         mdnsRecordType queryType = mdns_stream_read16(buffer);
         uint16_t queryClass = mdns_stream_read16(buffer);
 
-        if (queryClass & 0x80) {
-            // should be sent via unicast, not supported
-            return;
+        uint8_t answers = question_answers(match, queryType);
+        if (answers == 0) {
+            continue;
         }
 
-        switch(queryType) {
-            case mdnsRecordTypePTR: {
-                // PTR records are for searching for services
-                for (uint8_t i = 0; i < handle->numServices; i++) {
-                    mdnsService *service = handle->services[i];
-                    char *proto = (service->protocol == mdnsProtocolTCP) ? "_tcp" : "_udp";
-                    if ((strcasecmp(serviceName[0], service->name) == 0) && (strcasecmp(serviceName[1], proto) == 0)) {
-                        LOG(TRACE, "mdns: responding to PTR query");
-                        uint16_t responseLen = 0;
-                        char *response = mdns_prepare_response(handle, mdnsRecordTypePTR, MDNS_MULTICAST_TTL, transactionID, &responseLen, service);
-                        mdns_send_udp_packet(handle, response, responseLen);
-                        break;
-                    }
-                }
-                break;
-            }
+        // the querier asked for a unicast response, records that have not been multicast within
+        // a quarter of their TTL are multicast anyway to refresh the other caches (RFC 6762 section 5.4)
+        if ((queryClass & 0x8000) && unicast && !(answers & ~multicast_within(handle, service, answers, MDNS_MULTICAST_TTL * 1000 / 4))) {
+            LOG(TRACE, "mdns: answering QU question by unicast");
+            send_unicast_answers(handle, service, answers, transactionID, ip, port);
+            continue;
+        }
+        response_add_answers(response, service, answers);
+    }
 
-            case mdnsRecordTypeA: {
-                // A records want to find an IP address for a hostname
-                if (strcasecmp(serviceName[0], handle->hostname) == 0) {
-                    LOG(TRACE, "mdns: responding to A query");
-                    uint16_t responseLen = 0;
-                    char *response = mdns_prepare_response(handle, mdnsRecordTypeA, MDNS_MULTICAST_TTL, transactionID, &responseLen, NULL);
-                    mdns_send_udp_packet(handle, response, responseLen);
-                    break;                    
-                }
-            }
+    if (numKnownAnswers > 0) {
+        parse_known_answers(response, buffer, numKnownAnswers);
+    }
 
-            case mdnsRecordTypeSRV:
-            case mdnsRecordTypeTXT: {
-                // TXT record, only answer if the complete service name is correct
-                if (strcasecmp(serviceName[0], handle->hostname) == 0) {
-                    for (uint8_t i = 0; i < handle->numServices; i++) {
-                        mdnsService *service = handle->services[i];
-                        char *proto = (service->protocol == mdnsProtocolTCP) ? "_tcp" : "_udp";
-                        if ((strcasecmp(serviceName[1], service->name) == 0) && (strcasecmp(serviceName[2], proto) == 0)) {
-                            LOG(TRACE, "mdns: responding to SRV or TXT query");
-                            uint16_t responseLen = 0;
-                            char *response = mdns_prepare_response(handle, mdnsRecordTypeTXT, MDNS_MULTICAST_TTL, transactionID, &responseLen, service);
-                            mdns_send_udp_packet(handle, response, responseLen);
-                            break;
-                        }
-                    }
-                }
+    if (response->pending || (response->numAnswerSets == numAnswerSets)) {
+        return; // already scheduled or nothing to answer
+    }
+
+    // the querier sends more known answers in the next packets (RFC 6762 section 7.2)
+    uint32_t delay = 0;
+    if (truncated) {
+        delay = mdns_random(MDNS_TRUNCATED_DELAY_MIN, MDNS_TRUNCATED_DELAY_MAX);
+    } else {
+        // other hosts may answer shared records too, so wait a bit (RFC 6762 section 6)
+        for (uint8_t i = 0; i < handle->numServices; i++) {
+            if (handle->services[i]->queuedAnswers & MDNS_RECORD_PTR) {
+                delay = mdns_random(MDNS_RESPONSE_DELAY_MIN, MDNS_RESPONSE_DELAY_MAX);
                 break;
             }
+        }
+    }
 
-            case mdnsRecordTypeAny: {
-                // This requests just everything about a host, officially deceprated but I can see it on the network
-                if (strcasecmp(serviceName[0], handle->hostname) == 0) {
-                    LOG(TRACE, "mdns: responding to ANY query");
-    
-                    // this is a cascade, we will send multiple packets to avoid
-                    // overloading the mtu
-                    for (uint8_t i = 0; i < handle->numServices; i++) {
-                        mdnsService *service = handle->services[i];
-                        uint16_t responseLen = 0;
-                        char *response = mdns_prepare_response(handle, mdnsRecordTypePTR, MDNS_MULTICAST_TTL, transactionID, &responseLen, service);
-                        mdns_send_udp_packet(handle, response, responseLen);                        
-                    }
-                    break;                    
-                }
-            }
+    if ((delay > 0) && mdns_schedule(&handle->scheduler, mdnsEventTypeResponse, NULL, mdns_now() + delay, 0)) {
+        response->pending = true;
+        return;
+    }
 
-            case mdnsRecordTypeAAAA:
-            default:
-                break;
-        }
+    // unique records are answered right away
+    response_send(response, MDNS_MULTICAST_TTL);
+}
 
+void mdns_send_pending_response(mdnsHandle *handle) {
+    mdnsResponse *response = &handle->response;
+    if (!response->pending) {
+        return;
     }
+
+    response->pending = false;
+    response_send(response, MDNS_MULTICAST_TTL);
 }
+
+void mdns_cancel_pending_response(mdnsHandle *handle) {
+    mdns_unschedule(&handle->scheduler, mdnsEventTypeResponse, NULL);
+    handle->response.pending = false;
+}
+
 #endif /* !MDNS_BROADCAST_ONLY */
 
+uint32_t mdns_known_answer_saved_bytes(mdnsHandle *handle) {
+    return handle->knownAnswerSavedBytes;
+}
+
 void mdns_announce(mdnsHandle *handle) {
     LOG(DEBUG, "mdns: Announcing");
+#if !MDNS_BROADCAST_ONLY
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        mark_multicast(handle, handle->services[i], MDNS_RECORDS_SERVICE);
+    }
+    mark_multicast(handle, NULL, MDNS_RECORDS_HOST);
+#endif
+
     // respond with our data, setting most significant bit in RRClass to update caches
-    send_mdns_response_packet(handle, MDNS_MULTICAST_TTL, 0, NULL);
+    send_mdns_response_packet(handle, mdnsRecordTypePTR, MDNS_RECORDS_ALL, MDNS_MULTICAST_TTL, 0, NULL, NULL, 0);
 }
 
 void mdns_goodbye(mdnsHandle *handle) {
     LOG(DEBUG, "mdns: Goodbye");
     // send announce packet with TTL of zero
-    send_mdns_response_packet(handle, 0, 0, NULL);
+    send_mdns_response_packet(handle, mdnsRecordTypePTR, MDNS_RECORDS_ALL, 0, 0, NULL, NULL, 0);
+}
+
+void mdns_announce_host(mdnsHandle *handle) {
+    LOG(DEBUG, "mdns: Announcing address");
+#if !MDNS_BROADCAST_ONLY
+    mark_multicast(handle, NULL, MDNS_RECORDS_HOST);
+#endif
+
+    // records are sent with the cache flush bit, so other hosts drop the old address
+    send_mdns_response_packet(handle, mdnsRecordTypeA, MDNS_RECORDS_HOST, MDNS_MULTICAST_TTL, 0, NULL, NULL, 0);
+}
+
+void mdns_announce_services(mdnsHandle *handle) {
+    LOG(DEBUG, "mdns: Announcing changed services");
+#if !MDNS_BROADCAST_ONLY
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        if (handle->services[i]->announce) {
+            mark_multicast(handle, handle->services[i], MDNS_RECORDS_SERVICE);
+        }
+    }
+#endif
+
+    // the host records did not change, so only the records of the marked services
+    mdnsCascade cascade = { MDNS_RECORD_PTR, 0, true };
+    while (cascade.record & MDNS_RECORDS_ALL) {
+        mdnsSendBuffer send;
+        char *buffer = mdns_send_buffer_acquire(&send, MDNS_MAX_PACKET_SIZE);
+        if (buffer == NULL) {
+            return;
+        }
+        uint16_t len = mdns_prepare_response(handle, buffer, MDNS_MAX_PACKET_SIZE, MDNS_RECORD_PTR, MDNS_RECORDS_SERVICE, MDNS_MULTICAST_TTL, 0, NULL, &cascade);
+        mdns_send_buffer_commit(handle, &send, len);
+        if (len == 0) {
+            return;
+        }
+    }
+}
+
+void mdns_goodbye_service(mdnsHandle *handle, mdnsService *service) {
+    LOG(DEBUG, "mdns: Goodbye %s", service->name);
+
+    // the service may be destroyed once the task is done with the command, so the records are sent right away
+    mdnsCascade cascade = { MDNS_RECORD_PTR, 0, false };
+    while (cascade.record & MDNS_RECORDS_ALL) {
+        mdnsSendBuffer send;
+        char *buffer = mdns_send_buffer_acquire(&send, MDNS_MAX_PACKET_SIZE);
+        if (buffer == NULL) {
+            return;
+        }
+        uint16_t len = mdns_prepare_response(handle, buffer, MDNS_MAX_PACKET_SIZE, MDNS_RECORD_PTR, MDNS_RECORDS_SERVICE, 0, 0, service, &cascade);
+        mdns_send_buffer_commit(handle, &send, len);
+        if (len == 0) {
+            return;
+        }
+    }
 }
 
 #endif /* MDNS_ENABLE_PUBLISH */
\ No newline at end of file
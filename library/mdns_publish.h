@@ -3,15 +3,45 @@
 
 #include <mdns/mdns.h>
 #include "stream.h"
+#include "mdns_network.h"
 
-// this one is implemented in libplatform
-uint16_t mdns_send_udp_packet(mdnsHandle *handle, char *data, uint16_t len);
+#if !MDNS_BROADCAST_ONLY
+// Response accumulator, collects the records for all questions until the response is sent
+typedef struct _mdnsResponse {
+    mdnsHandle *handle;
+    uint16_t transactionID;
+
+    // host records, service records are queued in the services
+    uint8_t hostAnswers;
+    uint8_t hostAdditionals;
+
+    // the single answer set if only one was queued, so it can be sent from the response cache
+    uint8_t numAnswerSets;
+    uint8_t lastAnswers;
+    mdnsService *lastService;
+
+    // some queued records were suppressed, so the cached cascades do not apply
+    bool suppressed;
+
+    // response is waiting for its send event
+    bool pending;
+} mdnsResponse;
+#endif /* !MDNS_BROADCAST_ONLY */
 
 // these are implemented here
 
-// parse mdns query and react to it
+// watch responses of other hosts and parse mdns queries to react to them
 #if !MDNS_BROADCAST_ONLY
-void mdns_parse_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQueries, uint16_t transactionID);
+void mdns_parse_response(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numRecords);
+
+// questions with the unicast-response bit are answered directly to ip and port
+void mdns_parse_query(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numQueries, uint16_t numKnownAnswers, uint16_t transactionID, bool truncated, ip_addr_t *ip, uint16_t port);
+
+// send the pending response when its event is due
+void mdns_send_pending_response(mdnsHandle *handle);
+
+// forget the pending response (call when services are removed)
+void mdns_cancel_pending_response(mdnsHandle *handle);
 #endif
 
 // announce services
@@ -20,4 +50,13 @@ void mdns_announce(mdnsHandle *handle);
 // send goodbye packet
 void mdns_goodbye(mdnsHandle *handle);
 
+// announce the address records (after the address changed)
+void mdns_announce_host(mdnsHandle *handle);
+
+// announce the records of the services marked for announcement (after they have been added or changed)
+void mdns_announce_services(mdnsHandle *handle);
+
+// send a goodbye packet for the records of one service (call on the task when it is removed)
+void mdns_goodbye_service(mdnsHandle *handle, mdnsService *service);
+
 #endif /* mdns_mdns_publish_h_included */
\ No newline at end of file
@@ -1,124 +1,518 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
 #include <mdns/mdns.h>
 #include "mdns_query.h"
 #include "mdns_network.h"
 
+#include "query.h"
+#include "server.h"
+#include "tools.h"
+#include "debug.h"
+
 //
 // QUERY
 //
 
 #if MDNS_ENABLE_QUERY
-void mdns_parse_answers(mdnsStreamBuf *buffer, uint16_t numAnswers) {
-    LOG(TRACE, "mdns: Parsing %d answers", numAnswers);
 
-    char *serviceName[4];
+// deadlines wrap around, so compare the difference
+static inline bool is_due(uint32_t deadline, uint32_t now) {
+    return (int32_t)(deadline - now) <= 0;
+}
 
-    while (numAnswers--) {
-        // Read FQDN
-        uint8_t stringsRead = 0;
-        do {
-            uint8_t len = mdns_stream_read8(buffer);
-            if (len & 0xC0) { // Compressed pointer (not supported)
-                (void)mdns_stream_read8(buffer);
-                break;
+static inline uint32_t next_send(mdnsQueryHandle *query, uint32_t now) {
+    if (query->interval == 0) {
+        return now; // never sent
+    }
+    return query->lastSend + query->interval;
+}
+
+// when the next query has to go out, there has to be at least one query
+static uint32_t earliest_send(mdnsHandle *handle, uint32_t now) {
+    uint32_t earliest = next_send(handle->queries[0], now);
+    for (uint8_t i = 1; i < handle->numQueries; i++) {
+        uint32_t next = next_send(handle->queries[i], now);
+        if (!is_due(earliest, next)) {
+            earliest = next;
+        }
+    }
+
+    return earliest;
+}
+
+// start a query packet, returns false if there is no buffer
+static bool start_query(mdnsSendBuffer *send, mdnsWriter *writer) {
+    char *buffer = mdns_send_buffer_acquire(send, MDNS_MAX_PACKET_SIZE);
+    if (buffer == NULL) {
+        return false;
+    }
+    mdns_writer_init(writer, buffer, MDNS_MAX_PACKET_SIZE);
+
+    // transaction ID and flags are zero for multicast queries, the counts are filled in by finish_query
+    memset(writer->ptr, 0, 12);
+    writer->ptr += 12;
+    return true;
+}
+
+// send the packet, truncated tells responders that more known answers follow
+static void finish_query(mdnsHandle *handle, mdnsSendBuffer *send, mdnsWriter *writer, uint16_t numQuestions, bool truncated) {
+    if ((numQuestions == 0) && (writer->numRecords == 0)) {
+        mdns_send_buffer_commit(handle, send, 0);
+        return;
+    }
+
+    if (truncated) {
+        writer->packet[2] |= 0x02; // TC
+    }
+    writer->packet[4] = numQuestions >> 8;
+    writer->packet[5] = numQuestions & 0xff;
+    writer->packet[6] = writer->numRecords >> 8;
+    writer->packet[7] = writer->numRecords & 0xff;
+    mdns_send_buffer_commit(handle, send, mdns_writer_len(writer));
+}
+
+// list the cached answers that still have half of their TTL left, so responders
+// do not send them again (RFC 6762 section 7.1). Continues behind the record in cursor
+// (NULL to start) and moves it along, returns false when the packet is full.
+static bool add_known_answers(mdnsHandle *handle, mdnsWriter *writer, mdnsQueryHandle *query, mdnsCachedRecord **cursor, uint32_t now) {
+    mdnsCachedRecord *record = *cursor;
+    while ((record = mdns_record_cache_find(&handle->records, query->name, query->nameLen, mdnsRecordTypePTR, record))) {
+        uint32_t remaining = mdns_record_cache_remaining(record, now);
+        if ((remaining >= record->ttl / 2) &&
+            !mdns_make_known_answer(writer, mdns_cached_record_name(record), record->nameLen, mdnsRecordTypePTR,
+                                    remaining / 1000, mdns_cached_record_data(record), record->dataLen)) {
+            return false;
+        }
+        *cursor = record;
+    }
+    return true;
+}
+
+// the first two queries are one second apart, after that the actual interval
+// doubles up to one hour
+static void back_off(mdnsQueryHandle *query, uint32_t now) {
+    if (query->interval == 0) {
+        query->interval = MDNS_QUERY_INTERVAL_MIN;
+    } else {
+        query->interval = 2 * (now - query->lastSend);
+        if (query->interval > MDNS_QUERY_INTERVAL_MAX) {
+            query->interval = MDNS_QUERY_INTERVAL_MAX;
+        }
+    }
+    query->lastSend = now;
+    LOG(TRACE, "mdns: querying %s, next query in %d ms", query->service, query->interval);
+}
+
+// send the packet with the questions of the due queries in [first, last), known answers follow the questions
+static void send_query_packet(mdnsHandle *handle, mdnsSendBuffer *send, mdnsWriter *writer, uint8_t first, uint8_t last, uint32_t now) {
+    uint16_t numQuestions = 0;
+    bool started = true;
+
+    for (uint8_t i = first; i < last; i++) {
+        if (is_due(next_send(handle->queries[i], now), now)) {
+            numQuestions++;
+        }
+    }
+
+    for (uint8_t i = first; (i < last) && started; i++) {
+        if (!is_due(next_send(handle->queries[i], now), now)) {
+            continue;
+        }
+
+        mdnsCachedRecord *cursor = NULL;
+        while (!add_known_answers(handle, writer, handle->queries[i], &cursor, now)) {
+            if ((numQuestions == 0) && (writer->numRecords == 0)) {
+                break; // does not even fit into an empty packet, the responders send it
             }
-            if (len == 0x00) { // End of name
+
+            // the rest of the known answers follows in packets without questions, the
+            // responders wait for them while TC is set (RFC 6762 section 7.2)
+            finish_query(handle, send, writer, numQuestions, true);
+            numQuestions = 0;
+            started = start_query(send, writer);
+            if (!started) {
+                LOG(ERROR, "mdns: no buffer for the remaining known answers");
                 break;
             }
-            if (stringsRead > 4) {
-                return;
+        }
+    }
+    if (started) {
+        finish_query(handle, send, writer, numQuestions, false);
+    }
+
+    for (uint8_t i = first; i < last; i++) {
+        if (is_due(next_send(handle->queries[i], now), now)) {
+            back_off(handle->queries[i], now);
+        }
+    }
+}
+
+// hash the name at the read position label by label, parentKey leaves out the first label.
+// Moves the read position behind the name, returns its wire format length or 0 if it is malformed.
+static uint8_t hash_name(mdnsStreamBuf *buffer, uint32_t *key, uint32_t *parentKey) {
+    mdnsNameIterator iterator;
+    mdns_name_iterator_init(&iterator, buffer);
+
+    *key = MDNS_HASH_INIT;
+    *parentKey = MDNS_HASH_INIT;
+    bool first = true;
+
+    int16_t len;
+    while ((len = mdns_name_iterator_next(&iterator)) > 0) {
+        uint32_t hash = mdns_stream_hash_label(buffer, len);
+        *key = mdns_hash_combine(*key, hash);
+        if (!first) {
+            *parentKey = mdns_hash_combine(*parentKey, hash);
+        }
+        first = false;
+    }
+
+    if ((len < 0) || !mdns_name_iterator_finish(&iterator)) {
+        return 0;
+    }
+    return iterator.length;
+}
+
+// wire format name without its first label
+static inline const char *parent_name(const char *name) {
+    return (name[0] == 0) ? name : name + name[0] + 1;
+}
+
+static inline bool is_address(mdnsRecordType type) {
+    return (type == mdnsRecordTypeA) || (type == mdnsRecordTypeAAAA);
+}
+
+static mdnsQueryHandle *find_query(mdnsHandle *handle, uint32_t key) {
+    for (uint8_t i = 0; i < handle->numQueries; i++) {
+        if (handle->queries[i]->key == key) {
+            return handle->queries[i];
+        }
+    }
+    return NULL;
+}
+
+// the query a record belongs to, NULL if nobody asked for it.
+// Keys may collide, so belongs_to verifies the name once it is decoded.
+static mdnsQueryHandle *match_record(mdnsHandle *handle, mdnsRecordType type, uint32_t key, uint32_t parentKey) {
+    switch (type) {
+        case mdnsRecordTypePTR:
+            // _type._protocol.local
+            return find_query(handle, key);
+
+        case mdnsRecordTypeSRV:
+        case mdnsRecordTypeTXT:
+            // instance._type._protocol.local
+            return find_query(handle, parentKey);
+
+        case mdnsRecordTypeA:
+        case mdnsRecordTypeAAAA: {
+            // hostname.local, the target of a cached SRV record
+            mdnsCachedRecord *record = NULL;
+            while ((record = mdns_record_cache_next(&handle->records, record))) {
+                if ((record->type == mdnsRecordTypeSRV) && (mdns_name_key(mdns_cached_record_data(record) + 6) == key)) {
+                    mdnsQueryHandle *query = find_query(handle, mdns_name_key(parent_name(mdns_cached_record_name(record))));
+                    if (query) {
+                        return query;
+                    }
+                }
+            }
+            return NULL;
+        }
+
+        default:
+            return NULL;
+    }
+}
+
+// compare the decoded name of a record with the names of the query it was matched to
+static bool belongs_to(mdnsHandle *handle, mdnsQueryHandle *query, mdnsRecordType type, const char *name) {
+    switch (type) {
+        case mdnsRecordTypePTR:
+            return strcasecmp(name, query->name) == 0;
+
+        case mdnsRecordTypeSRV:
+        case mdnsRecordTypeTXT:
+            return (name[0] != 0) && (strcasecmp(parent_name(name), query->name) == 0);
+
+        default: {
+            mdnsCachedRecord *record = NULL;
+            while ((record = mdns_record_cache_next(&handle->records, record))) {
+                if ((record->type == mdnsRecordTypeSRV) &&
+                    (strcasecmp(mdns_cached_record_data(record) + 6, name) == 0) &&
+                    (strcasecmp(parent_name(mdns_cached_record_name(record)), query->name) == 0)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+}
+
+// size of the cached data of a record, 0 if the record is not cached or malformed
+static uint16_t cached_data_length(mdnsStreamBuf *buffer, mdnsRecordType type, uint16_t dataLength) {
+    switch (type) {
+        case mdnsRecordTypeA:
+            return (dataLength == 4) ? 4 : 0;
+        case mdnsRecordTypeAAAA:
+            return (dataLength == 16) ? 16 : 0;
+        case mdnsRecordTypeTXT:
+            return dataLength;
+        case mdnsRecordTypePTR:
+            // names are decompressed
+            return mdns_stream_name_length(buffer);
+        case mdnsRecordTypeSRV: {
+            // priority, weight and port followed by the target
+            if ((dataLength < 7) || !mdns_stream_skip(buffer, 6)) {
+                return 0;
             }
-            serviceName[stringsRead] = mdns_stream_read_string(buffer, len);
-            stringsRead++;
-        } while (true);
+            uint8_t targetLen = mdns_stream_name_length(buffer);
+            mdns_stream_seek(buffer, mdns_stream_tell(buffer) - 6);
+            return (targetLen > 0) ? 6 + targetLen : 0;
+        }
+        default:
+            return 0;
+    }
+}
 
-#if DEBUG_LEVEL <= TRACE
-        for (uint8_t i = 0; i < stringsRead; i++) {
-            LOG(TRACE, "mdns: serviceName[%d] = %s", i, serviceName[i]);
+// copy the data of a record into the cache, the read position is at the start of the data
+static bool read_cached_data(mdnsStreamBuf *buffer, mdnsRecordType type, char *data, uint16_t len) {
+    switch (type) {
+        case mdnsRecordTypePTR:
+            return mdns_stream_read_wire_name(buffer, data);
+        case mdnsRecordTypeSRV:
+            return (mdns_stream_read_bytes(buffer, data, 6) == 6) && mdns_stream_read_wire_name(buffer, data + 6);
+        default:
+            return mdns_stream_read_bytes(buffer, data, len) == len;
+    }
+}
+
+// address records that came before the SRV record pointing to them
+typedef struct _mdnsAddressRetry {
+    uint16_t offset;     // first address record nobody asked for, zero if none
+    uint16_t numRecords; // records from there on
+    bool srvAdded;       // an SRV record was added after it
+} mdnsAddressRetry;
+
+// cache the records that belong to a query, everything else is skipped in one step.
+// Returns false if the packet is malformed.
+static bool parse_records(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numRecords, mdnsAddressRetry *retryOrNull, uint32_t now) {
+    while (numRecords--) {
+        // the name is hashed while streaming, it is only decoded if it matches
+        uint16_t nameOffset = mdns_stream_tell(buffer);
+        uint32_t key, parentKey;
+        uint8_t nameLen = hash_name(buffer, &key, &parentKey);
+        if (nameLen == 0) {
+            return false;
         }
-#endif
 
         mdnsRecordType answerType = mdns_stream_read16(buffer);
-        uint16_t answerClass = mdns_stream_read16(buffer) & 0x7f; // mask out top bit: cache buster flag
+        uint16_t answerClass = mdns_stream_read16(buffer);
         uint32_t answerTtl = mdns_stream_read32(buffer);
         uint16_t dataLength = mdns_stream_read16(buffer);
 
-        switch(answerType) {
-            case mdnsRecordTypeA: { // IPv4 Address
-                uint32_t answerIP = mdns_stream_read32(buffer);
-                LOG(TRACE, "mdns: Answer -> A: %d.%d.%d.%d", (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff );
-                // TODO: do something with IP
+        mdnsQueryHandle *query = NULL;
+        if (((answerClass & 0x7fff) == 0x0001) && (retryOrNull || is_address(answerType))) {
+            query = match_record(handle, answerType, key, parentKey);
+        }
+        if (query == NULL) {
+            if (retryOrNull && is_address(answerType) && (retryOrNull->offset == 0)) {
+                retryOrNull->offset = nameOffset;
+                retryOrNull->numRecords = numRecords + 1;
             }
-            case mdnsRecordTypePTR: { // Reverse lookup aka. Hostname
-                char *hostname = mdns_stream_read_string(buffer, dataLength);
-                if (hostname[0] == 0xc0) {
-                    free(hostname); // Compressed pointer (not supported)
-                }
-                // TODO: do something with hostname
-                LOG(TRACE, "mdns: Answer -> PTR: %s", hostname);
-                free(hostname);
+            if (!mdns_stream_skip(buffer, dataLength)) {
+                return false;
             }
-            case mdnsRecordTypeTXT: { // Text records
-                char **txt = NULL;
-                uint8_t numRecords = 0;
-
-                for (uint16_t i; i < dataLength; i++) {
-                    uint8_t len = mdns_stream_read8(buffer);
-                    if (len == 0) {
-                        break; // no record
-                    }
-                    char *record = mdns_stream_read_string(buffer, len);
-                    if (record[0] == '=') { // oer RFC 6763 Section 6.4
-                        free(record);
-                        continue;
-                    }
-                    i += len;
+            continue;
+        }
 
-                    txt = realloc(txt, sizeof(char *) * (numRecords + 1));
-                    txt[numRecords++] = record;
-                }
+        // make sure the record is complete before parsing it
+        uint16_t dataOffset = mdns_stream_tell(buffer);
+        if (!mdns_stream_skip(buffer, dataLength) || !mdns_stream_seek(buffer, dataOffset)) {
+            return false;
+        }
 
-                // TODO: do something with txt records
-#if DEBUG_LEVEL <= TRACE
-                LOG(TRACE, "mdns: Answer -> TXT (%d records):", numRecords);
-                for(uint8_t i = 0; i < numRecords; i++) {
-                    LOG(TRACE, "mdns: - %s", txt[i]);
-                }
-#endif
+        // decode straight into the cache
+        uint16_t cachedLength = cached_data_length(buffer, answerType, dataLength);
+        mdnsCachedRecord *record = NULL;
+        if (cachedLength > 0) {
+            record = mdns_record_cache_reserve(&handle->records, nameLen, cachedLength, now);
+        }
+        if ((record != NULL) &&
+            mdns_stream_seek(buffer, nameOffset) &&
+            mdns_stream_read_wire_name(buffer, mdns_cached_record_name(record)) &&
+            mdns_stream_seek(buffer, dataOffset) &&
+            read_cached_data(buffer, answerType, mdns_cached_record_data(record), cachedLength) &&
+            belongs_to(handle, query, answerType, mdns_cached_record_name(record))) {
+            LOG(TRACE, "mdns: Answer for %s, type %d, ttl %d", query->service, answerType, answerTtl);
 
-                if (numRecords > 0) {
-                    for (uint8_t i; i < numRecords; i++) {
-                        free(txt[i]);
-                    }
-                    free(txt);
+            // top bit of the class is the cache flush flag
+            if (mdns_record_cache_commit(&handle->records, answerType, answerClass & 0x8000, answerTtl, now)) {
+                query->changed = true;
+                if (retryOrNull && (retryOrNull->offset != 0) && (answerType == mdnsRecordTypeSRV)) {
+                    retryOrNull->srvAdded = true;
                 }
             }
-            case mdnsRecordTypeSRV: { // Service records
-                uint16_t prio = mdns_stream_read16(buffer);
-                uint16_t weight = mdns_stream_read16(buffer);
-                uint16_t port = mdns_stream_read16(buffer);
+        }
 
-                uint16_t hostnameLen = mdns_stream_read16(buffer);
-                char *hostname = mdns_stream_read_string(buffer, hostnameLen);
+        if (!mdns_stream_seek(buffer, dataOffset + dataLength)) {
+            return false;
+        }
+    }
+
+    return true;
+}
 
-                // TODO: do something with service data
-                LOG(TRACE, "mdns: Answer -> SRV: %s", hostname);
+// split TXT strings at the first '=' into key and value, the result is one allocation
+// or, if bufferOrNull is set, the strings that fit into its size bytes
+static mdnsTxtRecord *make_txt_records(mdnsCachedRecord *txt, void *bufferOrNull, uint16_t size, uint8_t *numRecords) {
+    const uint8_t *data = (const uint8_t *)mdns_cached_record_data(txt);
+    uint8_t count = 0;
+    uint16_t needed = 0;
 
-                free(hostname);               
+    for (uint16_t i = 0; (i < txt->dataLen) && (count < 255); i += data[i] + 1) {
+        if ((data[i] > 0) && (i + 1 < txt->dataLen) && (data[i + 1] != '=')) { // per RFC 6763 Section 6.4
+            // key and value get a terminator each
+            uint16_t len = (data[i] > txt->dataLen - i - 1) ? txt->dataLen - i - 1 : data[i];
+            if (bufferOrNull && (needed + sizeof(mdnsTxtRecord) + len + 2 > size)) {
+                break;
             }
+            needed += sizeof(mdnsTxtRecord) + len + 2;
+            count++;
+        }
+    }
+    *numRecords = 0;
+    if (count == 0) {
+        return NULL;
+    }
 
-            case mdnsRecordTypeAAAA:
-                LOG(TRACE, "mdns: Answer -> AAAA: skipping");
-                // fallthrough
+    mdnsTxtRecord *records = bufferOrNull;
+#if !MDNS_STATIC_ALLOC
+    if (records == NULL) {
+        records = malloc(needed);
+    }
+#endif
+    char *strings = (char *)(records + count);
 
-            default:
-                // Ignore these, just skip over the buffer
-                for (uint16_t i = 0; i < dataLength; i++) {
-                    (void)mdns_stream_read8(buffer);
+    for (uint16_t i = 0; (i < txt->dataLen) && (*numRecords < count); i += data[i] + 1) {
+        uint8_t len = data[i];
+        if (len > txt->dataLen - i - 1) {
+            len = txt->dataLen - i - 1; // truncated string
+        }
+        if ((len == 0) || (data[i + 1] == '=')) {
+            continue;
+        }
+
+        const char *string = (const char *)data + i + 1;
+        const char *equals = memchr(string, '=', len);
+        uint8_t keyLen = equals ? equals - string : len;
+
+        records[*numRecords].name = strings;
+        memcpy(strings, string, keyLen);
+        strings += keyLen;
+        *strings++ = '\0';
+
+        records[*numRecords].value = strings;
+        if (equals) {
+            memcpy(strings, equals + 1, len - keyLen - 1);
+            strings += len - keyLen - 1;
+        }
+        *strings++ = '\0';
+
+        (*numRecords)++;
+    }
+
+    return records;
+}
+
+static void report_instance(mdnsHandle *handle, mdnsQueryHandle *query, const char *instance, mdnsCachedRecord *srv, mdnsCachedRecord *txt, mdnsCachedRecord *address) {
+    char name[MDNS_MAX_LABEL_LENGTH + 1];
+    mdnsService service;
+    memset(&service, 0, sizeof(mdnsService));
+
+    // the first label of the instance name
+    memcpy(name, instance + 1, instance[0]);
+    name[(uint8_t)instance[0]] = '\0';
+    service.name = name;
+    service.protocol = query->protocol;
+
+    const uint8_t *data = (const uint8_t *)mdns_cached_record_data(srv);
+    service.port = (data[4] << 8) + data[5];
+    memcpy(&service.ip, mdns_cached_record_data(address), 4);
+
+    if (txt) {
+#if MDNS_STATIC_ALLOC
+        service.txtRecords = make_txt_records(txt, handle->txtScratch, sizeof(handle->txtScratch), &service.numTxtRecords);
+#else
+        service.txtRecords = make_txt_records(txt, NULL, 0, &service.numTxtRecords);
+#endif
+    }
+
+    LOG(DEBUG, "mdns: found %s for %s", name, query->service);
+    query->callback(&service);
+#if !MDNS_STATIC_ALLOC
+    free(service.txtRecords);
+#endif
+}
+
+// call back the queries for the complete instances this packet carried records of
+static void report_instances(mdnsHandle *handle, uint32_t now) {
+    for (uint8_t i = 0; i < handle->numQueries; i++) {
+        mdnsQueryHandle *query = handle->queries[i];
+        if (!query->changed) {
+            continue;
+        }
+        query->changed = false;
+        if (query->callback == NULL) {
+            continue;
+        }
+
+        mdnsCachedRecord *ptr = NULL;
+        while ((ptr = mdns_record_cache_find(&handle->records, query->name, query->nameLen, mdnsRecordTypePTR, ptr))) {
+            const char *instance = mdns_cached_record_data(ptr);
+            mdnsCachedRecord *srv = mdns_record_cache_find(&handle->records, instance, ptr->dataLen, mdnsRecordTypeSRV, NULL);
+            if (srv == NULL) {
+                continue;
+            }
+            mdnsCachedRecord *txt = mdns_record_cache_find(&handle->records, instance, ptr->dataLen, mdnsRecordTypeTXT, NULL);
+            // the newest address wins, a flushed one lingers for a second
+            mdnsCachedRecord *address = NULL;
+            mdnsCachedRecord *record = NULL;
+            while ((record = mdns_record_cache_find(&handle->records, mdns_cached_record_data(srv) + 6, srv->dataLen - 6, mdnsRecordTypeA, record))) {
+                if ((address == NULL) || ((int32_t)(record->received - address->received) >= 0)) {
+                    address = record;
                 }
-                break;
+            }
+            if (address == NULL) {
+                continue; // not resolved yet
+            }
+
+            if ((ptr->received == now) || (srv->received == now) || (address->received == now) || (txt && (txt->received == now))) {
+                report_instance(handle, query, instance, srv, txt, address);
+            }
         }
     }
-    return;    
+}
+
+void mdns_parse_answers(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numAnswers) {
+    LOG(TRACE, "mdns: Parsing %d answers", numAnswers);
+    uint32_t now = mdns_now();
+    mdnsAddressRetry retry = { 0 };
+
+    if (parse_records(handle, buffer, numAnswers, &retry, now) && retry.srvAdded) {
+        // the SRV record came after the address records, look at those again
+        mdns_stream_seek(buffer, retry.offset);
+        parse_records(handle, buffer, retry.numRecords, NULL, now);
+    }
+    report_instances(handle, now);
+
+    // new records may have earlier refresh deadlines
+    mdns_unschedule(&handle->scheduler, mdnsEventTypeRefresh, NULL);
+    uint32_t deadline = mdns_record_cache_expire(&handle->records, now);
+    if (deadline != MDNS_NO_DEADLINE) {
+        mdns_schedule_or_retry(handle, mdnsEventTypeRefresh, deadline, 0);
+    }
 }
 
 //
@@ -126,16 +520,116 @@ void mdns_parse_answers(mdnsStreamBuf *buffer, uint16_t numAnswers) {
 //
 
 void mdns_send_queries(mdnsHandle *handle) {
-    LOG(DEBUG, "mdns: Sending queries NOT IMPLEMENTED");
+    uint32_t now = mdns_now();
+    mdnsSendBuffer send;
+    mdnsWriter writer;
+
+    mdns_unschedule(&handle->scheduler, mdnsEventTypeQuery, NULL);
+    if (handle->numQueries == 0) {
+        return;
+    }
+
+    uint32_t earliest = earliest_send(handle, now);
+    if (!is_due(earliest, now)) {
+        mdns_schedule_or_retry(handle, mdnsEventTypeQuery, earliest, 0);
+        return;
+    }
+
+    // queries due shortly after this one are not sent early, as that would break the backoff,
+    // instead this one waits for them so they share a packet (RFC 6762 section 5.2)
+    uint32_t target = now;
+    for (uint8_t i = 0; i < handle->numQueries; i++) {
+        uint32_t next = next_send(handle->queries[i], now);
+        if (is_due(next, earliest + MDNS_QUERY_AGGREGATION_WINDOW) && !is_due(next, target)) {
+            target = next;
+        }
+    }
+    if (target != now) {
+        mdns_schedule_or_retry(handle, mdnsEventTypeQuery, target, 0);
+        return;
+    }
+
+    if (!start_query(&send, &writer)) {
+        mdns_schedule_or_retry(handle, mdnsEventTypeQuery, now + MDNS_QUERY_DELAY_MAX, 0);
+        return;
+    }
 
-    // TODO: send outstanding queries
-    
-    // send query, setting most significant bit in QClass to zero to get multicast responses
+    // A DNS-SD query is just a PTR query to _<service>._<protocol>.local, the responder
+    // usually sends SRV, TXT and A or AAAA as additional RRs
+    uint8_t first = 0;
+    for (uint8_t i = 0; i < handle->numQueries; i++) {
+        mdnsQueryHandle *query = handle->queries[i];
+        if (!is_due(next_send(query, now), now)) {
+            continue;
+        }
+
+        if (!mdns_make_question(&writer, query->name, query->nameLen, mdnsRecordTypePTR)) {
+            // packet is full, continue in the next one
+            send_query_packet(handle, &send, &writer, first, i, now);
+            first = i;
+            if (!start_query(&send, &writer)) {
+                // try the remaining queries again in a moment
+                mdns_schedule_or_retry(handle, mdnsEventTypeQuery, now + MDNS_QUERY_DELAY_MAX, 0);
+                return;
+            }
+            // a single question always fits into an empty packet
+            mdns_make_question(&writer, query->name, query->nameLen, mdnsRecordTypePTR);
+        }
+    }
+    send_query_packet(handle, &send, &writer, first, handle->numQueries, now);
+
+    // wake up for the next query that is due
+    mdns_schedule_or_retry(handle, mdnsEventTypeQuery, earliest_send(handle, now), 0);
+}
+
+void mdns_refresh_records(mdnsHandle *handle) {
+    uint32_t now = mdns_now();
+    mdnsSendBuffer send;
+    mdnsWriter writer;
+    uint16_t numQuestions = 0;
+    bool started = false;
+
+    mdns_unschedule(&handle->scheduler, mdnsEventTypeRefresh, NULL);
+    mdns_record_cache_expire(&handle->records, now);
+
+    mdnsCachedRecord *record = NULL;
+    while ((record = mdns_record_cache_next(&handle->records, record))) {
+        if ((record->refreshes >= MDNS_RECORD_CACHE_REFRESHES) || !is_due(mdns_record_cache_deadline(record), now)) {
+            continue;
+        }
+        char *name = mdns_cached_record_name(record);
+
+        // records are only refreshed while somebody is interested in them
+        if ((handle->numQueries > 0) && !started) {
+            started = start_query(&send, &writer);
+        }
+        if (started && !mdns_make_question(&writer, name, record->nameLen, record->type)) {
+            // packet is full, continue in the next one
+            finish_query(handle, &send, &writer, numQuestions, false);
+            numQuestions = 0;
+            started = start_query(&send, &writer) && mdns_make_question(&writer, name, record->nameLen, record->type);
+        }
+        if (started) {
+            numQuestions++;
+        }
 
-    // A DNS-SD query is just a PTR query to _<service>._<protocol>.local
-    // -> Usually the server will send additional RRs that contain SRV, TXT and at least one A or AAAA
-    // -> If that does not happen we have to send another query for those with the data from the PTR
-    // A MDNS query is just a A query to <hostname>.local
+        // one question refreshes all records with this name and type, refreshes
+        // that were missed are skipped
+        mdnsCachedRecord *other = NULL;
+        while ((other = mdns_record_cache_find(&handle->records, name, record->nameLen, record->type, other))) {
+            while ((other->refreshes < MDNS_RECORD_CACHE_REFRESHES) && is_due(mdns_record_cache_deadline(other), now)) {
+                other->refreshes++;
+            }
+        }
+    }
+    if (started) {
+        finish_query(handle, &send, &writer, numQuestions, false);
+    }
+
+    uint32_t deadline = mdns_record_cache_expire(&handle->records, now);
+    if (deadline != MDNS_NO_DEADLINE) {
+        mdns_schedule_or_retry(handle, mdnsEventTypeRefresh, deadline, 0);
+    }
 }
 
 #endif /* MDNS_ENABLE_QUERY */
\ No newline at end of file
@@ -5,8 +5,14 @@
 #include "stream.h"
 
 #if MDNS_ENABLE_QUERY
-void mdns_parse_answers(mdnsStreamBuf *buffer, uint16_t numAnswers);
+// cache the records of a response
+void mdns_parse_answers(mdnsHandle *handle, mdnsStreamBuf *buffer, uint16_t numAnswers);
+
+// send all queries that are due, schedules the next send
 void mdns_send_queries(mdnsHandle *handle);
+
+// drop expired records and ask for records that are about to expire
+void mdns_refresh_records(mdnsHandle *handle);
 #endif /* MDNS_ENABLE_QUERY */
 
 
@@ -1,24 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "query.h"
 
 #include <mdns/mdns.h>
+#include "mdns_network.h"
 #include "server.h"
+#include "tools.h"
+#include "debug.h"
 
 #if MDNS_ENABLE_QUERY
 
+#if MDNS_STATIC_ALLOC
+// query with its names in one pool slot
+typedef struct _mdnsQuerySlot {
+    mdnsQueryHandle query;
+    bool used;
+    char service[MDNS_MAX_LABEL_LENGTH + 1];
+    char name[MDNS_MAX_TYPE_NAME_LENGTH];
+} mdnsQuerySlot;
+
+static mdnsQuerySlot queryPool[MDNS_MAX_QUERIES];
+#endif
+
 mdnsQueryHandle *mdns_query(mdnsHandle *handle, char *service, mdnsProtocol protocol, mdnsQueryCallback *callback) {
     LOG(TRACE, "mdns: Creating query %s", service);
 
+#if MDNS_STATIC_ALLOC
+    mdnsQuerySlot *slot = NULL;
+    for (uint8_t i = 0; i < MDNS_MAX_QUERIES; i++) {
+        if (!queryPool[i].used) {
+            slot = &queryPool[i];
+            slot->used = true;
+            break;
+        }
+    }
+    if (slot == NULL) {
+        LOG(ERROR, "mdns: no free query for %s", service);
+        return NULL;
+    }
+    mdnsQueryHandle *qHandle = &slot->query;
+
+    // copy over service name, it is one label
+    uint8_t serviceLen = strlen(service);
+    if (serviceLen > MDNS_MAX_LABEL_LENGTH) {
+        serviceLen = MDNS_MAX_LABEL_LENGTH;
+    }
+    qHandle->service = slot->service;
+    memcpy(qHandle->service, service, serviceLen);
+    qHandle->service[serviceLen] = '\0';
+    qHandle->name = mdns_make_type_name(qHandle->service, protocol, slot->name, &qHandle->nameLen);
+#else
     mdnsQueryHandle *qHandle = malloc(sizeof(mdnsQueryHandle));
     
     // copy over service name
     uint8_t serviceLen = strlen(service);
     qHandle->service = malloc(serviceLen + 1);
     memcpy(qHandle->service, service, serviceLen + 1);
+    qHandle->name = mdns_make_type_name(qHandle->service, protocol, NULL, &qHandle->nameLen);
+#endif
 
     qHandle->protocol = protocol;
     qHandle->callback = callback;
+    qHandle->key = mdns_name_key(qHandle->name);
+    qHandle->changed = false;
+
+    // the task sends the first query soon, then backs off
+    qHandle->lastSend = 0;
+    qHandle->interval = 0;
 
-    mdns_add_query(handle, qHandle);
+    qHandle->cancelled = false;
+
+    if (!mdns_add_query(handle, qHandle)) {
+        mdns_query_free(qHandle);
+        return NULL;
+    }
 
     return qHandle;
 }
@@ -26,10 +82,18 @@ mdnsQueryHandle *mdns_query(mdnsHandle *handle, char *service, mdnsProtocol prot
 void mdns_query_destroy(mdnsHandle *handle, mdnsQueryHandle *query) {
     LOG(TRACE, "mdns: Destroying query %s", query->service);
 
+    // the task frees it once it let go of it
     mdns_remove_query(handle, query);
+}
 
+void mdns_query_free(mdnsQueryHandle *query) {
+#if MDNS_STATIC_ALLOC
+    ((mdnsQuerySlot *)query)->used = false;
+#else
     free(query->service);
+    free(query->name);
     free(query);
+#endif
 }
 
 #endif /* MDNS_ENABLE_QUERY */
@@ -2,6 +2,7 @@
 #define mdns_query_h_included
 
 #include <mdns/mdns.h>
+#include <stdbool.h>
 
 #if MDNS_ENABLE_QUERY
 
@@ -9,6 +10,23 @@ typedef struct _mdnsQueryHandle {
     char *service;
     mdnsProtocol protocol;
     mdnsQueryCallback *callback;
+
+    // pre-encoded wire format name: _service._protocol.local
+    char *name;
+    uint8_t nameLen;
+
+    // mdns_name_key of name, answers are matched against it
+    uint32_t key;
+
+    // continuous query state in ms, interval is zero until the first query went out
+    uint32_t lastSend;
+    uint32_t interval;
+
+    // records were added by the packet that is being parsed
+    bool changed;
+
+    // destroyed while the queue was full, the task frees it
+    volatile bool cancelled;
 } mdnsQueryHandle;
 
 #endif /* MDNS_ENABLE_QUERY */
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <strings.h>
+
+#include <mdns/mdns.h>
+#include "record_cache.h"
+
+#include "scheduler.h"
+#include "tools.h"
+#include "debug.h"
+
+#if MDNS_ENABLE_QUERY
+
+//
+// private
+//
+
+// deadlines wrap around, so compare the difference
+static inline bool is_due(uint32_t deadline, uint32_t now) {
+    return (int32_t)(deadline - now) <= 0;
+}
+
+static inline mdnsCachedRecord *record_at(mdnsRecordCache *cache, uint16_t offset) {
+    return (mdnsCachedRecord *)((char *)cache->data + offset);
+}
+
+static inline uint16_t offset_of(mdnsRecordCache *cache, mdnsCachedRecord *record) {
+    return (char *)record - (char *)cache->data;
+}
+
+static inline uint32_t expires(mdnsCachedRecord *record) {
+    return record->received + record->ttl;
+}
+
+// entries are padded, so the next header stays aligned
+static inline uint16_t entry_size(uint8_t nameLen, uint16_t dataLen) {
+    return (sizeof(mdnsCachedRecord) + nameLen + dataLen + 3) & ~3;
+}
+
+// close the gap behind the record, this keeps the arena compact
+static void remove_record(mdnsRecordCache *cache, mdnsCachedRecord *record) {
+    uint16_t offset = offset_of(cache, record);
+    uint16_t size = record->size;
+
+    memmove(record, (char *)record + size, cache->used - offset - size);
+    cache->used -= size;
+}
+
+static bool same_key(mdnsCachedRecord *record, uint32_t hash, const char *name, uint8_t nameLen, mdnsRecordType type) {
+    return (record->nameHash == hash) && (record->type == type) && (record->nameLen == nameLen) &&
+        (strcasecmp(mdns_cached_record_name(record), name) == 0);
+}
+
+// expire the record one second from now (RFC 6762 sections 10.1 and 10.2)
+static void expire_soon(mdnsCachedRecord *record, uint32_t now) {
+    if (is_due(expires(record), now + 1000)) {
+        return;
+    }
+    record->ttl = now + 1000 - record->received;
+    record->refreshes = MDNS_RECORD_CACHE_REFRESHES;
+}
+
+//
+// API
+//
+
+void mdns_record_cache_clear(mdnsRecordCache *cache) {
+    cache->used = 0;
+}
+
+mdnsCachedRecord *mdns_record_cache_reserve(mdnsRecordCache *cache, uint8_t nameLen, uint16_t dataLen, uint32_t now) {
+    uint16_t size = entry_size(nameLen, dataLen);
+    if (size > sizeof(cache->data)) {
+        return NULL;
+    }
+
+    if (cache->used + size > sizeof(cache->data)) {
+        mdns_record_cache_expire(cache, now);
+    }
+
+    // evict the records that would be gone first anyway
+    while (cache->used + size > sizeof(cache->data)) {
+        mdnsCachedRecord *victim = NULL;
+        for (mdnsCachedRecord *record = mdns_record_cache_next(cache, NULL); record; record = mdns_record_cache_next(cache, record)) {
+            if ((victim == NULL) || is_due(expires(record), expires(victim))) {
+                victim = record;
+            }
+        }
+        LOG(DEBUG, "mdns: record cache full, evicting a record");
+        remove_record(cache, victim);
+    }
+
+    mdnsCachedRecord *record = record_at(cache, cache->used);
+    record->size = size;
+    record->nameLen = nameLen;
+    record->dataLen = dataLen;
+
+    return record;
+}
+
+bool mdns_record_cache_commit(mdnsRecordCache *cache, mdnsRecordType type, bool cacheFlush, uint32_t ttl, uint32_t now) {
+    mdnsCachedRecord *added = record_at(cache, cache->used);
+    char *name = mdns_cached_record_name(added);
+    uint32_t hash = mdns_name_key(name);
+    bool known = false;
+
+    if (ttl > MDNS_RECORD_CACHE_MAX_TTL) {
+        ttl = MDNS_RECORD_CACHE_MAX_TTL;
+    }
+
+    for (mdnsCachedRecord *record = mdns_record_cache_next(cache, NULL); record; record = mdns_record_cache_next(cache, record)) {
+        if (!same_key(record, hash, name, added->nameLen, type)) {
+            continue;
+        }
+
+        if ((record->dataLen == added->dataLen) &&
+            (memcmp(mdns_cached_record_data(record), mdns_cached_record_data(added), added->dataLen) == 0)) {
+            known = true;
+            if (ttl == 0) {
+                expire_soon(record, now);
+            } else {
+                record->received = now;
+                record->ttl = ttl * 1000;
+                record->refreshes = 0;
+            }
+        } else if (cacheFlush && !is_due(now, record->received + 1000)) {
+            // the sender has the only valid set, records received within the last second
+            // are probably from the same announcement and stay
+            expire_soon(record, now);
+        }
+    }
+
+    if (known || (ttl == 0)) {
+        return false; // nothing to add
+    }
+
+    added->type = type;
+    added->refreshes = 0;
+    added->jitter = mdns_random(0, 2);
+    added->nameHash = hash;
+    added->received = now;
+    added->ttl = ttl * 1000;
+    cache->used += added->size;
+
+    return true;
+}
+
+mdnsCachedRecord *mdns_record_cache_find(mdnsRecordCache *cache, const char *name, uint8_t nameLen, mdnsRecordType type, mdnsCachedRecord *previous) {
+    uint32_t hash = mdns_name_key(name);
+
+    for (mdnsCachedRecord *record = mdns_record_cache_next(cache, previous); record; record = mdns_record_cache_next(cache, record)) {
+        if (same_key(record, hash, name, nameLen, type)) {
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+mdnsCachedRecord *mdns_record_cache_next(mdnsRecordCache *cache, mdnsCachedRecord *previous) {
+    uint16_t offset = 0;
+    if (previous) {
+        offset = offset_of(cache, previous) + previous->size;
+    }
+
+    if (offset >= cache->used) {
+        return NULL;
+    }
+    return record_at(cache, offset);
+}
+
+uint32_t mdns_record_cache_deadline(mdnsCachedRecord *record) {
+    if (record->refreshes >= MDNS_RECORD_CACHE_REFRESHES) {
+        return expires(record);
+    }
+
+    // 80%, 85%, 90% and 95% of the TTL plus up to 2%
+    return record->received + (record->ttl / 100) * (80 + 5 * record->refreshes + record->jitter);
+}
+
+uint32_t mdns_record_cache_remaining(mdnsCachedRecord *record, uint32_t now) {
+    if (is_due(expires(record), now)) {
+        return 0;
+    }
+    return expires(record) - now;
+}
+
+uint32_t mdns_record_cache_expire(mdnsRecordCache *cache, uint32_t now) {
+    uint32_t next = MDNS_NO_DEADLINE;
+    uint16_t offset = 0;
+
+    while (offset < cache->used) {
+        mdnsCachedRecord *record = record_at(cache, offset);
+        if (is_due(expires(record), now)) {
+            remove_record(cache, record); // the next record moved to this offset
+            continue;
+        }
+
+        uint32_t deadline = mdns_record_cache_deadline(record);
+        if ((next == MDNS_NO_DEADLINE) || is_due(deadline, next)) {
+            next = deadline;
+        }
+        offset += record->size;
+    }
+
+    return next;
+}
+
+#endif /* MDNS_ENABLE_QUERY */
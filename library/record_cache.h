@@ -0,0 +1,80 @@
+#ifndef mdns_record_cache_h_included
+#define mdns_record_cache_h_included
+
+#include <mdns/mdns.h>
+#include <stdbool.h>
+#include "dns.h"
+
+#if MDNS_ENABLE_QUERY
+
+// Bytes reserved for received records, the cache never allocates and
+// evicts the records closest to expiry when it is full
+#ifndef MDNS_RECORD_CACHE_SIZE
+#define MDNS_RECORD_CACHE_SIZE 1024
+#endif
+
+// longer TTLs are capped, so deadlines in ms do not wrap (in seconds)
+#define MDNS_RECORD_CACHE_MAX_TTL (24 * 60 * 60)
+
+// number of refresh queries before a record expires, at 80, 85, 90 and 95% of the TTL
+#define MDNS_RECORD_CACHE_REFRESHES 4
+
+// Received resource record, followed by its uncompressed wire format name and the
+// record data. Names in the data of PTR and SRV records are decompressed too.
+typedef struct _mdnsCachedRecord {
+    uint16_t size;      // whole entry including name, data and padding
+    uint16_t dataLen;
+    uint8_t type;       // mdnsRecordType, all cached types fit into a byte
+    uint8_t nameLen;    // including terminator
+    uint8_t refreshes;  // refresh queries sent for the current TTL
+    uint8_t jitter;     // random extra percent for the refresh queries (RFC 6762 section 5.2)
+    uint32_t nameHash;  // mdns_name_key of the name
+    uint32_t received;  // in ms, see mdns_now()
+    uint32_t ttl;       // in ms
+} mdnsCachedRecord;
+
+// Fixed size arena of cached records, records are packed 4 byte aligned
+typedef struct _mdnsRecordCache {
+    uint16_t used;
+    uint32_t data[MDNS_RECORD_CACHE_SIZE / 4];
+} mdnsRecordCache;
+
+static inline char *mdns_cached_record_name(mdnsCachedRecord *record) {
+    return (char *)(record + 1);
+}
+
+static inline char *mdns_cached_record_data(mdnsCachedRecord *record) {
+    return mdns_cached_record_name(record) + record->nameLen;
+}
+
+// drop all records
+void mdns_record_cache_clear(mdnsRecordCache *cache);
+
+// make room for a record behind the last one, returns NULL if it can not fit.
+// Fill in name and data, then call mdns_record_cache_commit before anything else.
+mdnsCachedRecord *mdns_record_cache_reserve(mdnsRecordCache *cache, uint8_t nameLen, uint16_t dataLen, uint32_t now);
+
+// add the reserved record, an identical record only gets its TTL updated. A TTL of zero is
+// a goodbye, cacheFlush replaces the other records of the same name and type.
+// Returns true if the record was added, false if it was known or a goodbye.
+bool mdns_record_cache_commit(mdnsRecordCache *cache, mdnsRecordType type, bool cacheFlush, uint32_t ttl, uint32_t now);
+
+// records with this name and type, pass NULL to get the first one and the last result to get the next
+mdnsCachedRecord *mdns_record_cache_find(mdnsRecordCache *cache, const char *name, uint8_t nameLen, mdnsRecordType type, mdnsCachedRecord *previous);
+
+// all records, pass NULL to get the first one and the last result to get the next
+mdnsCachedRecord *mdns_record_cache_next(mdnsRecordCache *cache, mdnsCachedRecord *previous);
+
+// time the next refresh query for a record is due, or the time it expires after the last one
+uint32_t mdns_record_cache_deadline(mdnsCachedRecord *record);
+
+// remaining TTL of a record in ms
+uint32_t mdns_record_cache_remaining(mdnsCachedRecord *record, uint32_t now);
+
+// remove expired records, returns the earliest deadline of the remaining
+// records or MDNS_NO_DEADLINE if the cache is empty
+uint32_t mdns_record_cache_expire(mdnsRecordCache *cache, uint32_t now);
+
+#endif /* MDNS_ENABLE_QUERY */
+
+#endif /* mdns_record_cache_h_included */
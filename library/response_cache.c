@@ -0,0 +1,154 @@
+#include <stdlib.h>
+
+#include <mdns/mdns.h>
+#include "response_cache.h"
+
+#include "server.h"
+#include "debug.h"
+
+#if MDNS_ENABLE_PUBLISH
+
+//
+// private
+//
+
+// skip over a (possibly compressed) name, returns offset after the name
+static uint16_t skip_name(char *data, uint16_t offset, uint16_t len) {
+    while (offset < len) {
+        uint8_t labelLen = data[offset];
+        if (labelLen == 0) {
+            return offset + 1;
+        }
+        if ((labelLen & 0xC0) == 0xC0) { // compressed pointer
+            return offset + 2;
+        }
+        offset += labelLen + 1;
+    }
+    return len;
+}
+
+// number of answer and additional records of a response
+static uint16_t count_records(const char *data) {
+    const uint8_t *header = (const uint8_t *)data;
+    return ((header[6] << 8) + header[7]) + ((header[10] << 8) + header[11]);
+}
+
+// walk all records of a response and remember where the TTL fields are,
+// ttlOffsets has room for all records
+static void find_ttl_offsets(mdnsCachedResponse *response) {
+    uint16_t numRecords = count_records(response->data);
+    uint16_t *offsets = response->ttlOffsets;
+    uint16_t numOffsets = 0;
+    uint16_t offset = 12; // header, responses never contain questions
+
+    while ((offset < response->len) && (numOffsets < numRecords)) {
+        offset = skip_name(response->data, offset, response->len);
+        offset += 2; // type
+        offset += 2; // class
+        if (offset + 6 > response->len) {
+            break;
+        }
+        offsets[numOffsets++] = offset;
+        offset += 4; // ttl
+
+        uint16_t dataLength = ((uint8_t)response->data[offset] << 8) + (uint8_t)response->data[offset + 1];
+        offset += 2 + dataLength;
+    }
+
+    response->numTtlOffsets = numOffsets;
+}
+
+#if MDNS_STATIC_ALLOC
+// take 4 byte aligned room from the arena of the handle, returns NULL if it is full
+static void *arena_alloc(mdnsHandle *handle, uint16_t size) {
+    size = (size + 3) & ~3;
+    if (size > sizeof(handle->responseCacheData) - handle->responseCacheUsed) {
+        return NULL;
+    }
+    void *result = (char *)handle->responseCacheData + handle->responseCacheUsed;
+    handle->responseCacheUsed += size;
+    return result;
+}
+#endif
+
+//
+// API
+//
+
+mdnsCachedResponse *mdns_response_cache_lookup(mdnsHandle *handle, mdnsRecordType type, mdnsService *serviceOrNull) {
+    for (mdnsCachedResponse *response = handle->responseCache; response != NULL; response = response->next) {
+        if ((response->type == type) && (response->service == serviceOrNull)) {
+            return response;
+        }
+    }
+    return NULL;
+}
+
+mdnsCachedResponse *mdns_response_cache_insert(mdnsHandle *handle, mdnsRecordType type, mdnsService *serviceOrNull, const char *data, uint16_t len) {
+    uint16_t numRecords = count_records(data);
+
+#if MDNS_STATIC_ALLOC
+    // entry, TTL offsets and packet in one piece, the arena is only reset by a flush
+    uint16_t used = handle->responseCacheUsed;
+    mdnsCachedResponse *response = arena_alloc(handle, sizeof(mdnsCachedResponse));
+    uint16_t *ttlOffsets = arena_alloc(handle, sizeof(uint16_t) * numRecords);
+    char *copy = arena_alloc(handle, len);
+    if ((response == NULL) || (ttlOffsets == NULL) || (copy == NULL)) {
+        LOG(TRACE, "mdns: response cache full, not caching type %d", type);
+        handle->responseCacheUsed = used;
+        return NULL;
+    }
+    memset(response, 0, sizeof(mdnsCachedResponse));
+    response->ttlOffsets = ttlOffsets;
+    response->data = copy;
+#else
+    mdnsCachedResponse *response = calloc(1, sizeof(mdnsCachedResponse));
+    response->ttlOffsets = malloc(sizeof(uint16_t) * numRecords);
+    response->data = malloc(len);
+#endif
+
+    response->type = type;
+    response->service = serviceOrNull;
+    memcpy(response->data, data, len);
+    response->len = len;
+    find_ttl_offsets(response);
+
+    response->next = handle->responseCache;
+    handle->responseCache = response;
+
+    LOG(TRACE, "mdns: cached response for type %d (%d bytes, %d records)", type, len, response->numTtlOffsets);
+    return response;
+}
+
+void mdns_response_cache_patch(mdnsCachedResponse *response, uint16_t transactionID, uint32_t ttl) {
+    response->data[0] = transactionID >> 8;
+    response->data[1] = transactionID & 0xff;
+
+    for (uint16_t i = 0; i < response->numTtlOffsets; i++) {
+        char *ptr = response->data + response->ttlOffsets[i];
+        *ptr++ = ttl >> 24;
+        *ptr++ = ttl >> 16;
+        *ptr++ = ttl >> 8;
+        *ptr++ = ttl & 0xff;
+    }
+}
+
+void mdns_response_cache_flush(mdnsHandle *handle) {
+#if MDNS_STATIC_ALLOC
+    handle->responseCache = NULL;
+    handle->responseCacheUsed = 0;
+#else
+    mdnsCachedResponse *response = handle->responseCache;
+    handle->responseCache = NULL;
+
+    while (response != NULL) {
+        mdnsCachedResponse *next = response->next;
+        free(response->ttlOffsets);
+        free(response->data);
+        free(response);
+        response = next;
+    }
+#endif
+}
+
+#endif /* MDNS_ENABLE_PUBLISH */
@@ -0,0 +1,40 @@
+#ifndef mdns_response_cache_h_included
+#define mdns_response_cache_h_included
+
+#include <mdns/mdns.h>
+#include "dns.h"
+
+#if MDNS_ENABLE_PUBLISH
+
+// Pre-serialized response packet for one (record type, service) pair
+typedef struct _mdnsCachedResponse {
+    struct _mdnsCachedResponse *next;
+
+    // cache key, service is NULL if the response covers all services
+    mdnsRecordType type;
+    mdnsService *service;
+
+    // wire format packet
+    char *data;
+    uint16_t len;
+
+    // offsets of all TTL fields in data, patched before each send
+    uint16_t *ttlOffsets;
+    uint16_t numTtlOffsets;
+} mdnsCachedResponse;
+
+// find a cached response, returns NULL if not cached yet
+mdnsCachedResponse *mdns_response_cache_lookup(mdnsHandle *handle, mdnsRecordType type, mdnsService *serviceOrNull);
+
+// insert a copy of a serialized response packet into the cache
+mdnsCachedResponse *mdns_response_cache_insert(mdnsHandle *handle, mdnsRecordType type, mdnsService *serviceOrNull, const char *data, uint16_t len);
+
+// patch transaction ID and TTLs of a cached response in place
+void mdns_response_cache_patch(mdnsCachedResponse *response, uint16_t transactionID, uint32_t ttl);
+
+// drop all cached responses (call when services, TXT records or IPs change)
+void mdns_response_cache_flush(mdnsHandle *handle);
+
+#endif /* MDNS_ENABLE_PUBLISH */
+
+#endif /* mdns_response_cache_h_included */
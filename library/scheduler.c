@@ -0,0 +1,123 @@
+#include <mdns/mdns.h>
+#include "scheduler.h"
+
+#include "debug.h"
+
+//
+// private
+//
+
+// deadlines wrap around, so compare the difference
+static inline bool is_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline void swap(mdnsScheduler *scheduler, uint8_t a, uint8_t b) {
+    mdnsEvent tmp = scheduler->events[a];
+    scheduler->events[a] = scheduler->events[b];
+    scheduler->events[b] = tmp;
+}
+
+static void sift_up(mdnsScheduler *scheduler, uint8_t index) {
+    while (index > 0) {
+        uint8_t parent = (index - 1) / 2;
+        if (!is_before(scheduler->events[index].deadline, scheduler->events[parent].deadline)) {
+            break;
+        }
+        swap(scheduler, index, parent);
+        index = parent;
+    }
+}
+
+static void sift_down(mdnsScheduler *scheduler, uint8_t index) {
+    while (true) {
+        uint8_t smallest = index;
+        uint8_t left = 2 * index + 1;
+        uint8_t right = left + 1;
+
+        if ((left < scheduler->numEvents) && is_before(scheduler->events[left].deadline, scheduler->events[smallest].deadline)) {
+            smallest = left;
+        }
+        if ((right < scheduler->numEvents) && is_before(scheduler->events[right].deadline, scheduler->events[smallest].deadline)) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        swap(scheduler, index, smallest);
+        index = smallest;
+    }
+}
+
+static void remove_at(mdnsScheduler *scheduler, uint8_t index) {
+    scheduler->numEvents--;
+    if (index == scheduler->numEvents) {
+        return;
+    }
+    scheduler->events[index] = scheduler->events[scheduler->numEvents];
+    sift_down(scheduler, index);
+    sift_up(scheduler, index);
+}
+
+//
+// API
+//
+
+bool mdns_schedule(mdnsScheduler *scheduler, mdnsEventType type, void *context, uint32_t deadline, uint32_t arg) {
+    if (scheduler->numEvents >= MDNS_MAX_EVENTS) {
+        LOG(ERROR, "mdns: too many pending events, dropping event of type %d", type);
+        return false;
+    }
+
+    uint8_t index = scheduler->numEvents++;
+    scheduler->events[index].deadline = deadline;
+    scheduler->events[index].type = type;
+    scheduler->events[index].context = context;
+    scheduler->events[index].arg = arg;
+    sift_up(scheduler, index);
+
+    return true;
+}
+
+void mdns_unschedule(mdnsScheduler *scheduler, mdnsEventType type, void *context) {
+    uint8_t i = 0;
+    while (i < scheduler->numEvents) {
+        if ((scheduler->events[i].type == type) && (scheduler->events[i].context == context)) {
+            remove_at(scheduler, i);
+            i = 0; // heap has been reordered
+        } else {
+            i++;
+        }
+    }
+}
+
+bool mdns_is_scheduled(mdnsScheduler *scheduler, mdnsEventType type, void *context) {
+    for (uint8_t i = 0; i < scheduler->numEvents; i++) {
+        if ((scheduler->events[i].type == type) && (scheduler->events[i].context == context)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t mdns_scheduler_timeout(mdnsScheduler *scheduler, uint32_t now) {
+    if (scheduler->numEvents == 0) {
+        return MDNS_NO_DEADLINE;
+    }
+
+    uint32_t deadline = scheduler->events[0].deadline;
+    if (!is_before(now, deadline)) {
+        return 0;
+    }
+    return deadline - now;
+}
+
+bool mdns_scheduler_pop(mdnsScheduler *scheduler, uint32_t now, mdnsEvent *event) {
+    if ((scheduler->numEvents == 0) || is_before(now, scheduler->events[0].deadline)) {
+        return false;
+    }
+
+    *event = scheduler->events[0];
+    remove_at(scheduler, 0);
+    return true;
+}
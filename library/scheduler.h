@@ -0,0 +1,52 @@
+#ifndef mdns_scheduler_h_included
+#define mdns_scheduler_h_included
+
+#include <mdns/mdns.h>
+#include <stdbool.h>
+
+// Maximum number of pending events
+#ifndef MDNS_MAX_EVENTS
+#define MDNS_MAX_EVENTS 16
+#endif
+
+// returned by mdns_scheduler_timeout if nothing is scheduled
+#define MDNS_NO_DEADLINE 0xffffffff
+
+typedef enum _mdnsEventType {
+    mdnsEventTypeResponse, // send the pending response
+    mdnsEventTypeAnnounce, // (re-)announce, arg is the number of announcements already sent
+    mdnsEventTypeAnnounceServices, // announce services marked for announcement, arg as above
+    mdnsEventTypeAnnounceHost, // announce the address records, arg as above
+    mdnsEventTypeQuery,    // send outstanding queries
+    mdnsEventTypeRefresh   // expire cached records and send refresh queries
+} mdnsEventType;
+
+typedef struct _mdnsEvent {
+    uint32_t deadline; // in ms, see mdns_now()
+    mdnsEventType type;
+    void *context;     // what the event is about, not owned
+    uint32_t arg;
+} mdnsEvent;
+
+// Pending events of the MDNS task, a binary min-heap ordered by deadline
+typedef struct _mdnsScheduler {
+    mdnsEvent events[MDNS_MAX_EVENTS];
+    uint8_t numEvents;
+} mdnsScheduler;
+
+// schedule an event, returns false if the scheduler is full
+bool mdns_schedule(mdnsScheduler *scheduler, mdnsEventType type, void *context, uint32_t deadline, uint32_t arg);
+
+// remove all events of a type with this context
+void mdns_unschedule(mdnsScheduler *scheduler, mdnsEventType type, void *context);
+
+// check if an event of a type with this context is pending
+bool mdns_is_scheduled(mdnsScheduler *scheduler, mdnsEventType type, void *context);
+
+// ms until the next event is due, zero if overdue, MDNS_NO_DEADLINE if nothing is scheduled
+uint32_t mdns_scheduler_timeout(mdnsScheduler *scheduler, uint32_t now);
+
+// remove the next event if it is due, returns false if no event is due
+bool mdns_scheduler_pop(mdnsScheduler *scheduler, uint32_t now, mdnsEvent *event);
+
+#endif /* mdns_scheduler_h_included */
@@ -4,115 +4,569 @@
 #include "mdns_network.h"
 #include "mdns_query.h"
 #include "mdns_publish.h"
+#include "query.h"
 #include "server.h"
+#include "tools.h"
 #include "debug.h"
 
-void mdns_server_task(void *userData) {
-    mdnsHandle *handle = userData;
-    mdnsTaskAction action = mdnsTaskActionNone;
-    int tmp;
-    LOG(TRACE, "mdns: Service task started");    
+// work collected while draining the queue, done once per wakeup
+typedef struct _mdnsTaskWork {
+    bool announce;         // announce all records
+    bool announceServices; // announce the services marked for announcement
+    bool announceHost;     // announce the address records
+    bool query;            // send the queries
+} mdnsTaskWork;
 
-    while (1) {
+#if MDNS_ENABLE_PUBLISH
+// (re-)start an announcement sequence, changes until the first announcement go out with it
+static void schedule_announcements(mdnsHandle *handle, mdnsEventType type) {
+    mdns_unschedule(&handle->scheduler, type, NULL);
+    mdns_schedule_or_retry(handle, type, mdns_now() + MDNS_ANNOUNCE_DELAY, 0);
+}
+
+// services are marked until their announcement sequence is done
+static void clear_service_announcements(mdnsHandle *handle) {
+    for (uint8_t i = 0; i < handle->numServices; i++) {
+        handle->services[i]->announce = 0;
+    }
+}
+#endif /* MDNS_ENABLE_PUBLISH */
+
+static void handle_event(mdnsHandle *handle, mdnsEvent *event) {
+    switch (event->type) {
+#if MDNS_ENABLE_PUBLISH
+#if !MDNS_BROADCAST_ONLY
+        case mdnsEventTypeResponse:
+            mdns_send_pending_response(handle);
+            break;
+#endif
+
+        case mdnsEventTypeAnnounce:
+        case mdnsEventTypeAnnounceServices:
+        case mdnsEventTypeAnnounceHost:
+            if (event->type == mdnsEventTypeAnnounce) {
+                mdns_announce(handle);
+            } else if (event->type == mdnsEventTypeAnnounceServices) {
+                mdns_announce_services(handle);
+            } else {
+                mdns_announce_host(handle);
+            }
+
+            if (event->arg + 1 < MDNS_NUM_ANNOUNCEMENTS) {
+                // repeat the announcement, the interval doubles every time (RFC 6762 section 8.3)
+                mdns_schedule_or_retry(handle, event->type, mdns_now() + (MDNS_ANNOUNCE_INTERVAL << event->arg), event->arg + 1);
+            } else if (event->type == mdnsEventTypeAnnounceServices) {
+                clear_service_announcements(handle);
+            }
 #if MDNS_BROADCAST_ONLY
-        // wait a maximum of 30 seconds then re-announce
-        if (xQueueReceive(handle->mdnsQueue, &tmp, 3000) == pdFALSE) {
-            tmp = mdnsTaskActionRestart; // if nothing happens for about 30 seconds, re-announce
-        }
+            else if (event->type == mdnsEventTypeAnnounce) {
+                // nobody can ask us, so re-announce periodically
+                mdns_schedule_or_retry(handle, mdnsEventTypeAnnounce, mdns_now() + MDNS_BROADCAST_INTERVAL, event->arg + 1);
+            }
+#endif
+            break;
+#endif /* MDNS_ENABLE_PUBLISH */
+
+#if MDNS_ENABLE_QUERY
+        case mdnsEventTypeQuery:
+            // send all queries that are due, schedules the next send
+            mdns_send_queries(handle);
+            break;
+
+        case mdnsEventTypeRefresh:
+            mdns_refresh_records(handle);
+            break;
+#endif /* MDNS_ENABLE_QUERY */
+
+        default:
+            break;
+    }
+}
+
+// release the payload of a message that will not be handled
+static void drop_message(mdnsHandle *handle, mdnsTaskMessage *message) {
+#if !MDNS_BROADCAST_ONLY
+    if (message->action == mdnsTaskActionPacket) {
+        mdns_network_buffer_free(message->received.packet);
+    }
+#endif
+}
+
+// commands change what the task works with, they are never dropped
+static bool is_command(mdnsTaskMessage *message) {
+    switch (message->action) {
+        case mdnsTaskActionUpdateIP:
+#if MDNS_ENABLE_QUERY
+        case mdnsTaskActionAddQuery:
+        case mdnsTaskActionRemoveQuery:
+#endif
+#if MDNS_ENABLE_PUBLISH
+        case mdnsTaskActionAddService:
+        case mdnsTaskActionAddTxt:
+        case mdnsTaskActionRemoveService:
+#endif
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+#if MDNS_ENABLE_QUERY
+static bool add_query(mdnsHandle *handle, mdnsQueryHandle *query) {
+#if MDNS_STATIC_ALLOC
+    if (handle->numQueries == MDNS_MAX_QUERIES) {
+        LOG(ERROR, "mdns: too many queries, ignoring %s", query->service);
+        return false;
+    }
 #else
-        // wait until we should do something
-        xQueueReceive(handle->mdnsQueue, &tmp, portMAX_DELAY);
+    handle->queries = realloc(handle->queries, sizeof(mdnsQueryHandle *) * (handle->numQueries + 1));
 #endif
-        action = (mdnsTaskAction)tmp;
+    handle->queries[handle->numQueries] = query;
+    handle->numQueries++;
 
-        // destroy messages are for the caller, not for us
-        if (action == mdnsTaskActionDestroy) {    
-            // re-insert into queue
-            xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
+    LOG(DEBUG, "mdns: adding query: %s", query->service);
+    return true;
+}
+
+static void remove_query(mdnsHandle *handle, mdnsQueryHandle *query) {
+    uint8_t i = 0;
+    while ((i < handle->numQueries) && (handle->queries[i] != query)) {
+        i++;
+    }
+    if (i == handle->numQueries) {
+        return; // not added to this handle
+    }
+
+    LOG(DEBUG, "mdns: removing query: %s", query->service);
+    for (; i < handle->numQueries - 1; i++) {
+        handle->queries[i] = handle->queries[i + 1];
+    }
+    handle->numQueries--;
+#if !MDNS_STATIC_ALLOC
+    if (handle->numQueries == 0) {
+        free(handle->queries);
+        handle->queries = NULL;
+    } else {
+        handle->queries = realloc(handle->queries, sizeof(mdnsQueryHandle *) * handle->numQueries);
+    }
+#endif
+}
 
-            // give up time slot
-            taskYIELD();
+// free the queries destroyed while the queue was full
+static void free_cancelled_queries(mdnsHandle *handle) {
+    if (!handle->queriesCancelled) {
+        return;
+    }
 
-            continue;
+    // cleared first, queries cancelled meanwhile are freed next time
+    handle->queriesCancelled = false;
+    uint8_t i = 0;
+    while (i < handle->numQueries) {
+        mdnsQueryHandle *query = handle->queries[i];
+        if (query->cancelled) {
+            remove_query(handle, query);
+            mdns_query_free(query);
+        } else {
+            i++;
         }
+    }
+}
+
+// the network may have changed, so start the query backoff over
+// and forget what was learned on the old network
+static void restart_queries(mdnsHandle *handle, mdnsTaskWork *work) {
+    mdns_record_cache_clear(&handle->records);
+    mdns_unschedule(&handle->scheduler, mdnsEventTypeRefresh, NULL);
+    for (uint8_t i = 0; i < handle->numQueries; i++) {
+        handle->queries[i]->interval = 0;
+    }
+    work->query = true;
+}
+#endif
+
+static void start(mdnsHandle *handle, mdnsTaskWork *work) {
+    // start up service
+    if (!mdns_join_multicast_group()) {
+        LOG(ERROR, "mdns: Joining multicast group failed");
+    }
+    handle->pcb = mdns_listen(handle);
+    handle->started = true;
+
+    // hosts answering at the same time should not pick the same delays
+    srand(handle->ip.addr ^ handle->hostnameHash ^ mdns_now());
 
-        switch (action) {
-            case mdnsTaskActionStart:
-                // start up service
-                if (!mdns_join_multicast_group()) {
-                    LOG(ERROR, "mdns: Joining multicast group failed");
-                }
-                handle->pcb = mdns_listen(handle);
+    // and announce the services on the network
+    work->announce = true;
+#if MDNS_ENABLE_QUERY
+    restart_queries(handle, work);
+#endif
+}
+
+static void update_address(mdnsHandle *handle, const ip_address_t *ip, const ip6_address_t *ip6, mdnsTaskWork *work) {
+    if ((memcmp(&handle->ip, ip, sizeof(ip_address_t)) == 0) &&
+        (memcmp(&handle->ip6, ip6, sizeof(ip6_address_t)) == 0)) {
+        return; // nothing changed
+    }
+
+    // the socket and group membership stay, only the address records change
+    memcpy(&handle->ip, ip, sizeof(ip_address_t));
+    memcpy(&handle->ip6, ip6, sizeof(ip6_address_t));
 #if MDNS_ENABLE_PUBLISH
-                // and announce the services on the network
-                mdns_announce(handle);
+    // every cached cascade ends with the address records
+    mdns_response_cache_flush(handle);
 #endif
-                handle->started = true;
-                break;
+    work->announceHost = true;
+}
+
+// take the address that did not fit into the queue, it is newer than the queued ones
+static void take_pending_address(mdnsHandle *handle, mdnsTaskWork *work) {
+    if (!handle->addressPending) {
+        return;
+    }
 
-            case mdnsTaskActionStop:
-                // cleanly shut down, this means sending a goodbye message
+    ip_address_t ip;
+    ip6_address_t ip6;
+    taskENTER_CRITICAL();
+    memcpy(&ip, &handle->pendingIp, sizeof(ip_address_t));
+    memcpy(&ip6, &handle->pendingIp6, sizeof(ip6_address_t));
+    handle->addressPending = false;
+    taskEXIT_CRITICAL();
+    update_address(handle, &ip, &ip6, work);
+}
+
+static void handle_message(mdnsHandle *handle, mdnsTaskMessage *message, mdnsTaskWork *work);
+
+static void stop(mdnsHandle *handle) {
+    mdnsTaskMessage message;
+    mdnsTaskWork work = { 0 };
+
+    // cleanly shut down, this means sending a goodbye message
 #if MDNS_ENABLE_PUBLISH
-                mdns_goodbye(handle);
-#endif
-                // shutdown socket
-                mdns_shutdown_socket(handle->pcb);
-                handle->pcb = NULL;
-                if (!mdns_leave_multicast_group()) {
-                    LOG(ERROR, "mdns: Leaving multicast group failed");
-                }
-                // notify parent and destroy this task
-                action = mdnsTaskActionDestroy;
-                xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
-                handle->started = false;
-                vTaskDelete(NULL);
-                break;
-
-            case mdnsTaskActionRestart:
-                // just force an announcement
+    mdns_goodbye(handle);
+#endif
+    // shutdown socket
+    mdns_shutdown_socket(handle->pcb);
+    handle->pcb = NULL;
+    if (!mdns_leave_multicast_group()) {
+        LOG(ERROR, "mdns: Leaving multicast group failed");
+    }
+
+    // forget everything that is still queued or scheduled, but carry out the commands
+    handle->started = false;
+    while (xQueueReceive(handle->mdnsQueue, &message, 0) == pdTRUE) {
+        if (is_command(&message)) {
+            handle_message(handle, &message, &work);
+        } else {
+            drop_message(handle, &message);
+        }
+    }
+    take_pending_address(handle, &work);
+#if MDNS_ENABLE_QUERY
+    free_cancelled_queries(handle);
+#endif
+    handle->scheduler.numEvents = 0;
+    handle->retryEvents = 0;
+    handle->overflow = false;
+#if MDNS_ENABLE_QUERY
+    mdns_record_cache_clear(&handle->records);
+#endif
 #if MDNS_ENABLE_PUBLISH
-                mdns_announce(handle);
+    clear_service_announcements(handle);
+#if !MDNS_BROADCAST_ONLY
+    handle->response.pending = false;
+#endif
+#endif
+
+    // notify parent and destroy this task
+    xSemaphoreGive(handle->stopped);
+#if MDNS_STATIC_ALLOC
+    // park until the next start instead, commands run on the caller meanwhile
+    xSemaphoreTake(handle->wakeup, portMAX_DELAY);
+#else
+    vTaskDelete(NULL);
+#endif
+}
+
+static void handle_message(mdnsHandle *handle, mdnsTaskMessage *message, mdnsTaskWork *work) {
+    switch (message->action) {
+        case mdnsTaskActionStart:
+            start(handle, work);
+            break;
+
+        case mdnsTaskActionStop:
+            // the task is gone or parked afterwards
+            stop(handle);
+#if MDNS_STATIC_ALLOC
+            // the parked task continues here when the service is started again,
+            // the start message is next in the queue
+            memset(work, 0, sizeof(mdnsTaskWork));
+#endif
+            return;
+
+        case mdnsTaskActionRestart:
+            work->announce = true;
+#if MDNS_ENABLE_QUERY
+            restart_queries(handle, work);
+#endif
+            break;
+
+        case mdnsTaskActionUpdateIP:
+            update_address(handle, &message->address.ip, &message->address.ip6, work);
+            break;
+
+#if MDNS_ENABLE_PUBLISH
+        case mdnsTaskActionAddService:
+            if (mdns_service_attach(handle, message->service) && handle->started) {
+                // only the new records have to be announced
+                message->service->announce = 1;
+                work->announceServices = true;
+            }
+            mdns_service_command_done(message->service);
+            break;
+
+        case mdnsTaskActionAddTxt:
+            mdns_service_append_txt(message->txt.service, &message->txt.record);
+            if ((message->txt.service->handle == handle) && handle->started) {
+                message->txt.service->announce = 1;
+                work->announceServices = true;
+            }
+            mdns_service_command_done(message->txt.service);
+            break;
+
+        case mdnsTaskActionRemoveService:
+#if !MDNS_BROADCAST_ONLY
+            if (handle->response.pending && (handle->response.lastService == message->service)) {
+                mdns_cancel_pending_response(handle);
+            }
 #endif
-                break;
-            
+            if (mdns_service_detach(handle, message->service) && handle->started) {
+                // stop announcing the service before saying goodbye, then it may be destroyed
+                mdns_goodbye_service(handle, message->service);
+            }
+            mdns_service_command_done(message->service);
+            break;
+#endif /* MDNS_ENABLE_PUBLISH */
+
 #if MDNS_ENABLE_QUERY
-            case mdnsTaskActionQuery:
-                // send all registered queries
-                mdns_send_queries(handle);
-                break;
+        case mdnsTaskActionAddQuery:
+            if (message->query->cancelled) {
+                // destroyed before the task got to it
+                mdns_query_free(message->query);
+            } else if (add_query(handle, message->query)) {
+                work->query = true;
+            }
+            break;
+
+        case mdnsTaskActionRemoveQuery:
+            // also frees a query that did not fit into the handle
+            remove_query(handle, message->query);
+            mdns_query_free(message->query);
+            break;
 #endif /* MDNS_ENABLE_QUERY */
 
-            default:
-                break;
+#if !MDNS_BROADCAST_ONLY
+        case mdnsTaskActionPacket: {
+            mdnsStreamBuf buffer;
+            mdns_stream_init(&buffer, message->received.packet);
+            mdns_parse_packet(handle, &buffer, &message->received.ip, message->received.port);
+            mdns_network_buffer_free(message->received.packet);
+            break;
         }
+#endif
+
+        default:
+            break;
     }
 }
 
+static void do_work(mdnsHandle *handle, mdnsTaskWork *work) {
+    take_pending_address(handle, work);
 #if MDNS_ENABLE_QUERY
-void mdns_add_query(mdnsHandle *handle, mdnsQueryHandle *query) {
-    // TODO: mutex lock handle->queries
-    handle->queries = realloc(handle->queries, sizeof(mdnsQueryHandle *) * (handle->numQueries + 1));
-    handle->queries[handle->numQueries] = query;
-    handle->numQueries++;
+    free_cancelled_queries(handle);
+#endif
 
-    LOG(DEBUG, "mdns: adding query: %s", query->service);
-    
-    mdnsTaskAction action = mdnsTaskActionQuery;
-    xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
+    if (handle->overflow) {
+        // commands were lost, so bring everybody up to date
+        LOG(DEBUG, "mdns: command queue overflowed, announcing everything");
+        handle->overflow = false;
+        work->announce = true;
+        work->query = true;
+    }
+
+#if MDNS_ENABLE_PUBLISH
+    if (work->announce) {
+#if !MDNS_BROADCAST_ONLY
+        // the announcement carries everything a pending response would
+        mdns_cancel_pending_response(handle);
+#endif
+        // a full announcement covers new services and addresses too
+        mdns_unschedule(&handle->scheduler, mdnsEventTypeAnnounceServices, NULL);
+        mdns_unschedule(&handle->scheduler, mdnsEventTypeAnnounceHost, NULL);
+        clear_service_announcements(handle);
+        schedule_announcements(handle, mdnsEventTypeAnnounce);
+    } else {
+        if (work->announceServices) {
+            // services marked since the last wakeup join the running sequence, which starts over
+            schedule_announcements(handle, mdnsEventTypeAnnounceServices);
+        }
+        if (work->announceHost) {
+            schedule_announcements(handle, mdnsEventTypeAnnounceHost);
+        }
+    }
+#endif
+
+#if MDNS_ENABLE_QUERY
+    if (work->query) {
+        // new queries wait a bit, so queries started together share a packet (RFC 6762 section 5.2)
+        mdns_unschedule(&handle->scheduler, mdnsEventTypeQuery, NULL);
+        mdns_schedule_or_retry(handle, mdnsEventTypeQuery, mdns_now() + mdns_random(MDNS_QUERY_DELAY_MIN, MDNS_QUERY_DELAY_MAX), 0);
+    }
+#endif
 }
 
-void mdns_remove_query(mdnsHandle *handle, mdnsQueryHandle *query) {
-    // TODO: mutex lock handle->queries
-    for(uint8_t i = 0; i < handle->numQueries; i++) {
-        if (handle->queries[i] == query) {
-            LOG(DEBUG, "mdns: removing query: %s", query->service);
-            for (uint8_t j = i + 1; j < handle->numQueries - 1; j++) {
-                handle->queries[i] = handle->queries[j];
-            }
+// events that did not fit into the scheduler are overdue by now, they run as soon as there is room.
+// A retried announcement starts its sequence over.
+static void retry_events(mdnsHandle *handle) {
+    for (uint8_t type = 0; handle->retryEvents >> type; type++) {
+        if ((handle->retryEvents & (1 << type)) && mdns_schedule(&handle->scheduler, type, NULL, mdns_now(), 0)) {
+            handle->retryEvents &= ~(1 << type);
         }
     }
-    handle->queries = realloc(handle->queries, sizeof(mdnsQueryHandle *) * (handle->numQueries - 1));
-    handle->numQueries--;
+}
+
+uint32_t mdns_server_task_timeout(mdnsHandle *handle) {
+    uint32_t timeout = mdns_scheduler_timeout(&handle->scheduler, mdns_now());
+    if (handle->retryEvents && (timeout > MDNS_RETRY_INTERVAL)) {
+        timeout = MDNS_RETRY_INTERVAL;
+    }
+    return timeout;
+}
+
+void mdns_server_task_step(mdnsHandle *handle, portTickType ticks) {
+    mdnsTaskMessage message;
+    mdnsEvent event;
+
+    // handle everything that is queued, repeated commands are only acted on once
+    mdnsTaskWork work = { 0 };
+    portBASE_TYPE received = xQueueReceive(handle->mdnsQueue, &message, ticks);
+    while (received == pdTRUE) {
+        handle_message(handle, &message, &work);
+        received = xQueueReceive(handle->mdnsQueue, &message, 0);
+    }
+    do_work(handle, &work);
+
+    // run everything that is due, retried events get the room that frees up
+    retry_events(handle);
+    while (mdns_scheduler_pop(&handle->scheduler, mdns_now(), &event)) {
+        handle_event(handle, &event);
+        retry_events(handle);
+    }
+}
+
+void mdns_server_task(void *userData) {
+    mdnsHandle *handle = userData;
+    LOG(TRACE, "mdns: Service task started");
+
+    while (1) {
+        // sleep until the next event is due or we get a message
+        uint32_t timeout = mdns_server_task_timeout(handle);
+        portTickType ticks = portMAX_DELAY;
+        if (timeout != MDNS_NO_DEADLINE) {
+            ticks = (timeout + portTICK_RATE_MS - 1) / portTICK_RATE_MS;
+        }
+        mdns_server_task_step(handle, ticks);
+    }
+}
+
+// enqueue without blocking, lost commands are made up for by a full announcement
+static bool post_message(mdnsHandle *handle, mdnsTaskMessage *message) {
+    if (xQueueSendToBack(handle->mdnsQueue, message, 0) == pdTRUE) {
+        return true;
+    }
+
+    LOG(ERROR, "mdns: command queue full, dropping command %d", message->action);
+    handle->overflow = true;
+    return false;
+}
+
+void mdns_post_action(mdnsHandle *handle, mdnsTaskAction action) {
+    mdnsTaskMessage message = { 0 };
+    message.action = action;
+
+    // start is waited for by the task and must never be lost
+    if (action == mdnsTaskActionStart) {
+        xQueueSendToBack(handle->mdnsQueue, &message, portMAX_DELAY);
+        return;
+    }
+    post_message(handle, &message);
+}
+
+void mdns_schedule_or_retry(mdnsHandle *handle, mdnsEventType type, uint32_t deadline, uint32_t arg) {
+    if (!mdns_schedule(&handle->scheduler, type, NULL, deadline, arg)) {
+        if (!(handle->retryEvents & (1 << type))) {
+            LOG(ERROR, "mdns: scheduler full, retrying event %d later", type);
+        }
+        handle->retryEvents |= 1 << type;
+    } else {
+        // scheduled again before the retry
+        handle->retryEvents &= ~(1 << type);
+    }
+}
+
+bool mdns_run_command(mdnsHandle *handle, mdnsTaskMessage *message) {
+    if ((handle->mdnsTask == NULL) || (xTaskGetCurrentTaskHandle() == handle->mdnsTask)) {
+        // nobody else works with the handle
+        mdnsTaskWork work = { 0 };
+        handle_message(handle, message, &work);
+        if (handle->started) {
+            do_work(handle, &work);
+        }
+        return true;
+    }
+
+    // callers may be event handlers, so never wait for room. Lost service changes
+    // could not be made up for, the caller gets to know instead.
+    if (xQueueSendToBack(handle->mdnsQueue, message, 0) != pdTRUE) {
+        LOG(ERROR, "mdns: command queue full, rejecting command %d", message->action);
+        return false;
+    }
+    return true;
+}
+
+#if !MDNS_BROADCAST_ONLY
+void mdns_receive_packet(mdnsHandle *handle, mdnsNetworkBuffer *packet, ip_addr_t *ip, uint16_t port) {
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionPacket;
+    message.received.packet = packet;
+    message.received.ip = *ip;
+    message.received.port = port;
+
+    // never block the network stack, drop the packet if the task is behind
+    if (xQueueSendToBack(handle->mdnsQueue, &message, 0) != pdTRUE) {
+        LOG(DEBUG, "mdns: queue full, dropping packet");
+        mdns_network_buffer_free(packet);
+    }
+}
+#endif /* !MDNS_BROADCAST_ONLY */
+
+#if MDNS_ENABLE_QUERY
+bool mdns_add_query(mdnsHandle *handle, mdnsQueryHandle *query) {
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionAddQuery;
+    message.query = query;
+    return mdns_run_command(handle, &message);
+}
+
+void mdns_remove_query(mdnsHandle *handle, mdnsQueryHandle *query) {
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionRemoveQuery;
+    message.query = query;
+    if (!mdns_run_command(handle, &message)) {
+        // the task is busy with the full queue and sweeps the query up afterwards
+        query->cancelled = true;
+        handle->queriesCancelled = true;
+    }
 }
 #endif /* MDNS_ENABLE_QUERY */
 
@@ -120,22 +574,64 @@ void mdns_remove_query(mdnsHandle *handle, mdnsQueryHandle *query) {
 // API
 //
 
+#if MDNS_STATIC_ALLOC
+static mdnsHandle handlePool[MDNS_MAX_HANDLES];
+static bool handlePoolUsed[MDNS_MAX_HANDLES];
+#endif
+
 mdnsHandle *mdns_create(char *hostname) {
     LOG(DEBUG, "mdns: creating MDNS service for %s", hostname);
     
+#if MDNS_STATIC_ALLOC
+    mdnsHandle *handle = NULL;
+    for (uint8_t i = 0; i < MDNS_MAX_HANDLES; i++) {
+        if (!handlePoolUsed[i]) {
+            handlePoolUsed[i] = true;
+            handle = &handlePool[i];
+            memset(handle, 0, sizeof(mdnsHandle));
+            break;
+        }
+    }
+    if (handle == NULL) {
+        LOG(ERROR, "mdns: no free handle");
+        return NULL;
+    }
+
+    // copy hostname and convert to lowercase, it is one label
+    uint8_t hostnameLen = strlen(hostname);
+    if (hostnameLen > MDNS_MAX_LABEL_LENGTH) {
+        hostnameLen = MDNS_MAX_LABEL_LENGTH;
+    }
+#else
     mdnsHandle *handle = calloc(1, sizeof(mdnsHandle));
 
     // duplicate hostname and convert to lowercase
     uint8_t hostnameLen = strlen(hostname);
     handle->hostname = malloc(hostnameLen + 1);
+#endif
     for (uint8_t i = 0; i < hostnameLen; i++) {
         handle->hostname[i] = tolower(hostname[i]);
     }
     handle->hostname[hostnameLen] = '\0';
+    handle->hostnameLen = hostnameLen;
+    handle->hostnameHash = mdns_label_hash(handle->hostname, hostnameLen);
+#if MDNS_STATIC_ALLOC
+    mdns_make_local(handle->hostname, handle->localName, &handle->localNameLen);
+#else
+    handle->localName = mdns_make_local(handle->hostname, NULL, &handle->localNameLen);
+#endif
     
     handle->started = false;
     
-    handle->mdnsQueue = xQueueCreate(1, sizeof(int));
+    handle->mdnsQueue = xQueueCreate(MDNS_QUEUE_LENGTH, sizeof(mdnsTaskMessage));
+
+    // binary semaphores are created given
+    vSemaphoreCreateBinary(handle->stopped);
+    xSemaphoreTake(handle->stopped, 0);
+#if MDNS_STATIC_ALLOC
+    vSemaphoreCreateBinary(handle->wakeup);
+    xSemaphoreTake(handle->wakeup, 0);
+#endif
     return handle;
 }
 
@@ -143,30 +639,43 @@ mdnsHandle *mdns_create(char *hostname) {
 void mdns_start(mdnsHandle *handle) {
     LOG(DEBUG, "mdns: Starting service");
 
+#if MDNS_STATIC_ALLOC
+    if (handle->parkedTask) {
+        // the parked task picks up the start message once woken up
+        handle->mdnsTask = handle->parkedTask;
+        handle->parkedTask = NULL;
+        mdns_post_action(handle, mdnsTaskActionStart);
+        xSemaphoreGive(handle->wakeup);
+        LOG(TRACE, "mdns: Service started");
+        return;
+    }
+#endif
+
     if (xTaskCreate(mdns_server_task, "mdns", 250, handle, 3, &handle->mdnsTask) != pdPASS) {
         LOG(ERROR, "mdns: Could not create service, terminating");
         mdns_destroy(handle);
     }
-    mdnsTaskAction action = mdnsTaskActionStart;
-    xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
+    mdns_post_action(handle, mdnsTaskActionStart);
     LOG(TRACE, "mdns: Service started");    
 }
 
 // Stop broadcasting MDNS records
 void mdns_stop(mdnsHandle *handle) {
+    if (handle->mdnsTask == NULL) {
+        return; // not started
+    }
     LOG(DEBUG, "mdns: Stopping service");
 
-    mdnsTaskAction action = mdnsTaskActionStop;
-    xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
-
-    // wait for mdns service to stop
-    action = mdnsTaskActionNone;
-    mdnsTaskAction *ptr = &action;
-    while (action != mdnsTaskActionDestroy) {
-        taskYIELD();
-        xQueuePeek(handle->mdnsQueue, ptr, portMAX_DELAY);
-    }
-    // FIXME: clear queue
+    // wait for mdns service to stop, it carries out the commands queued before.
+    // The only call that blocks, the handle may be destroyed afterwards.
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionStop;
+    xQueueSendToBack(handle->mdnsQueue, &message, portMAX_DELAY);
+    xSemaphoreTake(handle->stopped, portMAX_DELAY);
+#if MDNS_STATIC_ALLOC
+    handle->parkedTask = handle->mdnsTask;
+#endif
+    handle->mdnsTask = NULL;
     LOG(TRACE, "mdns: Service stopped");    
 }
 
@@ -174,8 +683,7 @@ void mdns_stop(mdnsHandle *handle) {
 void mdns_restart(mdnsHandle *handle) {
     LOG(DEBUG, "mdns: Restarting service");
 
-    mdnsTaskAction action = mdnsTaskActionRestart;
-    xQueueSendToBack(handle->mdnsQueue, &action, portMAX_DELAY);
+    mdns_post_action(handle, mdnsTaskActionRestart);
 
     LOG(TRACE, "mdns: Service restarted");
 }
@@ -186,18 +694,28 @@ void mdns_update_ip(mdnsHandle *handle, const ip_address_t ip, const ip6_address
     LOG(DEBUG, "mdns: Updating IPv6 to %x:%x:%x:%x", ip6.addr[0], ip6.addr[1], ip6.addr[2], ip6.addr[3]);
 
 
-    if (memcmp(&handle->ip, &ip, sizeof(ip_address_t) != 0) ||
-        memcmp(&handle->ip6, &ip6, sizeof(ip6_address_t)) != 0) {
-        
-        bool restart = handle->started;
-        if (restart) {
-            mdns_stop(handle);
-        }
-        memcpy(&handle->ip, &ip, sizeof(ip_address_t));
-        memcpy(&handle->ip6, &ip6, sizeof(ip6_address_t));
-        if (restart) {
-            mdns_start(handle);
-        }
+    // a running task swaps the address and announces it, the response cache is its own
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionUpdateIP;
+    memcpy(&message.address.ip, &ip, sizeof(ip_address_t));
+    memcpy(&message.address.ip6, &ip6, sizeof(ip6_address_t));
+
+    // once an address is pending, newer ones replace it so they are not taken before it
+    taskENTER_CRITICAL();
+    bool pending = handle->addressPending;
+    if (pending) {
+        memcpy(&handle->pendingIp, &ip, sizeof(ip_address_t));
+        memcpy(&handle->pendingIp6, &ip6, sizeof(ip6_address_t));
+    }
+    taskEXIT_CRITICAL();
+
+    // called from WiFi events, so a full queue leaves the address for the task to take
+    if (!pending && !mdns_run_command(handle, &message)) {
+        taskENTER_CRITICAL();
+        memcpy(&handle->pendingIp, &ip, sizeof(ip_address_t));
+        memcpy(&handle->pendingIp6, &ip6, sizeof(ip6_address_t));
+        handle->addressPending = true;
+        taskEXIT_CRITICAL();
     }
 }
 
@@ -210,17 +728,40 @@ void mdns_destroy(mdnsHandle *handle) {
         mdns_stop(handle);
     }
 
+#if MDNS_ENABLE_PUBLISH
     // destroy all services
     uint8_t numServices = handle->numServices;
     handle->numServices = 0;
     for(uint8_t i = 0; i < numServices; i++) {
         mdns_service_destroy(handle->services[i]);
     }
+
+    // drop pre-serialized responses
+    mdns_response_cache_flush(handle);
+#endif
+
+#if MDNS_STATIC_ALLOC
+    // the parked task waits for the wakeup
+    if (handle->parkedTask) {
+        vTaskDelete(handle->parkedTask);
+    }
+    vQueueDelete(handle->mdnsQueue);
+    vSemaphoreDelete(handle->stopped);
+    vSemaphoreDelete(handle->wakeup);
+
+    // give back the pool slot
+    handlePoolUsed[handle - handlePool] = false;
+#else
     free(handle->services);
 
     // free hostname
     free(handle->hostname);
+    free(handle->localName);
+
+    vQueueDelete(handle->mdnsQueue);
+    vSemaphoreDelete(handle->stopped);
 
     // free complete handle
     free(handle);
+#endif
 }
\ No newline at end of file
@@ -3,25 +3,83 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 
 #include "platform.h"
 
 #include <mdns/mdns.h>
+#include "response_cache.h"
+#include "record_cache.h"
+#include "service_index.h"
+#include "scheduler.h"
+#include "mdns_publish.h"
+#include "tools.h"
 
 // MDNS Server handle
 struct _mdnsHandle {
+#if MDNS_STATIC_ALLOC
+    // Hostname to broadcast
+    char hostname[MDNS_MAX_LABEL_LENGTH + 1];
+    uint8_t hostnameLen;
+    uint32_t hostnameHash;
+
+    // pre-encoded wire format name: hostname.local
+    char localName[MDNS_MAX_LOCAL_NAME_LENGTH];
+    uint8_t localNameLen;
+
+    // Services to broadcast
+    mdnsService *services[MDNS_MAX_SERVICES];
+    uint8_t numServices;
+#else
     // Hostname to broadcast
     char *hostname;
+    uint8_t hostnameLen;
+    uint32_t hostnameHash;
+
+    // pre-encoded wire format name: hostname.local
+    char *localName;
+    uint8_t localNameLen;
 
     // Services to broadcast
     mdnsService **services;
     uint8_t numServices;
+#endif
 
     // freertos task and queue
     xTaskHandle mdnsTask;
     xQueueHandle mdnsQueue;
 
+    // given by the task once it stopped, mdns_stop waits for it
+    xSemaphoreHandle stopped;
+
+#if MDNS_STATIC_ALLOC
+    // stopped task waiting for the next start, creating a task allocates its stack
+    xTaskHandle parkedTask;
+
+    // given to wake up the parked task, the start message is queued before
+    xSemaphoreHandle wakeup;
+#endif
+
+    // a restart did not fit into the queue, the task then announces everything
+    volatile bool overflow;
+
+    // latest address that did not fit into the queue, the task takes it after the queued ones
+    volatile bool addressPending;
+    ip_address_t pendingIp;
+    ip6_address_t pendingIp6;
+
+#if MDNS_ENABLE_QUERY
+    // queries destroyed while the queue was full, the task frees them
+    volatile bool queriesCancelled;
+#endif
+
+    // timed events of the task, only touched by the task
+    mdnsScheduler scheduler;
+
+    // types of events that did not fit into the scheduler, a bit per mdnsEventType
+    uint8_t retryEvents;
+
     // UDP port handle
     mdnsUDPHandle *pcb;
 
@@ -30,9 +88,45 @@ struct _mdnsHandle {
     ip6_address_t ip6;
     bool started;
 
+#if MDNS_ENABLE_PUBLISH
+    // pre-serialized responses
+    mdnsCachedResponse *responseCache;
+#if MDNS_STATIC_ALLOC
+    // arena the cached responses are packed into, 4 byte aligned
+    uint16_t responseCacheUsed;
+    uint32_t responseCacheData[MDNS_RESPONSE_CACHE_SIZE / 4];
+#endif
+
+    // services by type and instance name
+    mdnsServiceIndex serviceIndex;
+
+    // response bytes not sent because of known-answer suppression
+    uint32_t knownAnswerSavedBytes;
+
+    // time the A and AAAA records were last multicast in ms, zero if never
+    uint32_t lastMulticast[2];
+
+#if !MDNS_BROADCAST_ONLY
+    // response waiting for its random delay to pass
+    mdnsResponse response;
+#endif
+#endif
+
 #if MDNS_ENABLE_QUERY
+#if MDNS_STATIC_ALLOC
+    mdnsQueryHandle *queries[MDNS_MAX_QUERIES];
+#else
     mdnsQueryHandle **queries;
+#endif
     uint8_t numQueries;
+
+    // records received for the queries, only touched by the task
+    mdnsRecordCache records;
+
+#if MDNS_STATIC_ALLOC
+    // TXT records of a found service for the query callback, only touched by the task
+    uint32_t txtScratch[MDNS_QUERY_TXT_SIZE / 4];
+#endif
 #endif
 };
 
@@ -41,15 +135,104 @@ typedef enum _mdnsTaskAction {
     mdnsTaskActionStart,
     mdnsTaskActionStop,
     mdnsTaskActionRestart,
+    mdnsTaskActionUpdateIP,
 #if MDNS_ENABLE_QUERY
-    mdnsTaskActionQuery,
+    mdnsTaskActionAddQuery,
+    mdnsTaskActionRemoveQuery,
+#endif
+#if !MDNS_BROADCAST_ONLY
+    mdnsTaskActionPacket,
+#endif
+#if MDNS_ENABLE_PUBLISH
+    mdnsTaskActionAddService,
+    mdnsTaskActionAddTxt,
+    mdnsTaskActionRemoveService,
 #endif
-    mdnsTaskActionDestroy
 } mdnsTaskAction;
 
+// Message to the MDNS task, the payload depends on the action
+typedef struct _mdnsTaskMessage {
+    mdnsTaskAction action;
+
+    union {
+        // mdnsTaskActionPacket: received packet and its sender
+        struct {
+            mdnsNetworkBuffer *packet;
+            ip_addr_t ip;
+            uint16_t port;
+        } received;
+
+        // mdnsTaskActionUpdateIP: new addresses
+        struct {
+            ip_address_t ip;
+            ip6_address_t ip6;
+        } address;
+
+        // mdnsTaskActionAddService, mdnsTaskActionRemoveService
+        mdnsService *service;
+
+        // mdnsTaskActionAddTxt: copy of the TXT record to append, owned by the service then
+        struct {
+            mdnsService *service;
+            mdnsTxtRecord record;
+        } txt;
+
+#if MDNS_ENABLE_QUERY
+        // mdnsTaskActionAddQuery, mdnsTaskActionRemoveQuery: the task frees removed queries
+        mdnsQueryHandle *query;
+#endif
+    };
+} mdnsTaskMessage;
+
+// maximum number of messages waiting for the task
+#ifndef MDNS_QUEUE_LENGTH
+#define MDNS_QUEUE_LENGTH 16
+#endif
+
+// ms until the task tries again to schedule events that did not fit into the scheduler
+#ifndef MDNS_RETRY_INTERVAL
+#define MDNS_RETRY_INTERVAL 1000
+#endif
+
+// one pass of the task loop: waits up to ticks for a message, handles everything that is
+// queued and runs the events that are due. The host harness runs the task in these steps.
+void mdns_server_task_step(mdnsHandle *handle, portTickType ticks);
+
+// ms until the next event is due or events that did not fit into the scheduler are retried,
+// MDNS_NO_DEADLINE if the task only waits for messages
+uint32_t mdns_server_task_timeout(mdnsHandle *handle);
+
+// send an action to the MDNS task, only start blocks while the queue is full
+void mdns_post_action(mdnsHandle *handle, mdnsTaskAction action);
+
+// schedule an event of the task that has no context. If the scheduler is full, the event is
+// run once there is room again instead of being lost, so its handler has to check what is due.
+void mdns_schedule_or_retry(mdnsHandle *handle, mdnsEventType type, uint32_t deadline, uint32_t arg);
+
+// run a command on the MDNS task, which owns the services and queries while it runs. Never
+// blocks, returns false if the queue is full. Runs right away without a task or when called
+// by the task itself.
+bool mdns_run_command(mdnsHandle *handle, mdnsTaskMessage *message);
+
+// the commands on services, run by mdns_run_command (service.c)
+#if MDNS_ENABLE_PUBLISH
+// returns false if the service was added already or the handle has no room for another one
+bool mdns_service_attach(mdnsHandle *handle, mdnsService *service);
+// returns false if the service was not added to the handle
+bool mdns_service_detach(mdnsHandle *handle, mdnsService *service);
+// takes over the copied record
+void mdns_service_append_txt(mdnsService *service, mdnsTxtRecord *record);
+// the task is done with a command on the service, destroys it if that was asked for meanwhile
+void mdns_service_command_done(mdnsService *service);
+#endif
+
 #if MDNS_ENABLE_QUERY
-void mdns_add_query(mdnsHandle *handle, mdnsQueryHandle *query);
+// returns false if the queue is full
+bool mdns_add_query(mdnsHandle *handle, mdnsQueryHandle *query);
+// the query is freed by the task, or right away without one
 void mdns_remove_query(mdnsHandle *handle, mdnsQueryHandle *query);
+// frees a removed query (query.c)
+void mdns_query_free(mdnsQueryHandle *query);
 #endif /* MDNS_ENABLE_QUERY */
 
 #endif /* mdns_server_h_included */
\ No newline at end of file
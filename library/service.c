@@ -4,67 +4,344 @@
 #include <mdns/mdns.h>
 
 #include "server.h"
+#include "tools.h"
+#include "response_cache.h"
+#include "service_index.h"
 #include "debug.h"
 
+#if MDNS_ENABLE_PUBLISH
+
+#if MDNS_STATIC_ALLOC
+// service with its names and TXT records in one pool slot
+typedef struct _mdnsServiceSlot {
+    mdnsService service;
+    bool used;
+    char name[MDNS_MAX_LABEL_LENGTH + 1];
+    char typeName[MDNS_MAX_TYPE_NAME_LENGTH];
+    char instanceName[MDNS_MAX_FQDN_LENGTH];
+    mdnsTxtRecord txtRecords[MDNS_MAX_TXT_RECORDS];
+    uint8_t txtReserved;
+    uint16_t txtUsed;
+    char txt[MDNS_MAX_TXT_BYTES];
+} mdnsServiceSlot;
+
+static mdnsServiceSlot servicePool[MDNS_MAX_SERVICES];
+
+#define SERVICE_SLOT(service) ((mdnsServiceSlot *)(service))
+
+// copy a string into the TXT arena of a service
+static char *copy_txt_string(mdnsServiceSlot *slot, const char *string, uint16_t len) {
+    char *copy = slot->txt + slot->txtUsed;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    slot->txtUsed += len + 1;
+    return copy;
+}
+#endif
+
+// zeroed service, from the pool in static builds
+static mdnsService *alloc_service(void) {
+#if MDNS_STATIC_ALLOC
+    for (uint8_t i = 0; i < MDNS_MAX_SERVICES; i++) {
+        mdnsServiceSlot *slot = &servicePool[i];
+        if (!slot->used) {
+            memset(slot, 0, sizeof(mdnsServiceSlot));
+            slot->used = true;
+            slot->service.txtRecords = slot->txtRecords;
+            return &slot->service;
+        }
+    }
+    return NULL;
+#else
+    return calloc(1, sizeof(mdnsService));
+#endif
+}
 
 mdnsService *mdns_create_service(char *name, mdnsProtocol protocol, uint16_t port) {
-    mdnsService *service = calloc(1, sizeof(mdnsService));
+    mdnsService *service = alloc_service();
+    if (service == NULL) {
+        LOG(ERROR, "mdns: no free service for %s", name);
+        return NULL;
+    }
+
+#if MDNS_STATIC_ALLOC
+    // the name is one label
+    service->nameLen = strlen(name);
+    if (service->nameLen > MDNS_MAX_LABEL_LENGTH) {
+        service->nameLen = MDNS_MAX_LABEL_LENGTH;
+    }
+    service->name = SERVICE_SLOT(service)->name;
+    memcpy(service->name, name, service->nameLen);
+#else
     service->name = strdup(name);
+    service->nameLen = strlen(name);
+#endif
+    service->nameHash = mdns_label_hash(service->name, service->nameLen);
     service->protocol = protocol;
     service->port = port;
+#if MDNS_STATIC_ALLOC
+    service->typeName = mdns_make_service_name(service, SERVICE_SLOT(service)->typeName, &service->typeNameLen);
+#else
+    service->typeName = mdns_make_service_name(service, NULL, &service->typeNameLen);
+#endif
 
     return service;
 }
 
-void mdns_service_add_txt(mdnsService *service, char *key, char *value) {
-    service->txtRecords = realloc(service->txtRecords, sizeof(mdnsTxtRecord) * (service->numTxtRecords + 1));
-    
-    service->txtRecords[service->numTxtRecords].name = strdup(key);
-    service->txtRecords[service->numTxtRecords].value = strdup(value);
-    service->numTxtRecords++;
+mdnsService *mdns_create_declared_service(const mdnsServiceDeclaration *declaration) {
+    mdnsService *service = alloc_service();
+    if (service == NULL) {
+        // the name is in flash and can not be logged
+        LOG(ERROR, "mdns: no free service for the one declared on port %d", declaration->port);
+        return NULL;
+    }
+
+    // the names are copied from flash once, the TXT record data when sending
+    service->declaration = declaration;
+#if MDNS_STATIC_ALLOC
+    service->name = SERVICE_SLOT(service)->name;
+    service->typeName = SERVICE_SLOT(service)->typeName;
+#else
+    service->name = malloc(declaration->nameLen + 1);
+    service->typeName = malloc(declaration->typeNameLen);
+#endif
+    mdns_flash_read(service->name, declaration->name, declaration->nameLen);
+    service->name[declaration->nameLen] = '\0';
+    service->nameLen = declaration->nameLen;
+    service->nameHash = mdns_label_hash(service->name, service->nameLen);
+    service->protocol = declaration->protocol;
+    service->port = declaration->port;
+    mdns_flash_read(service->typeName, declaration->typeName, declaration->typeNameLen);
+    service->typeNameLen = declaration->typeNameLen;
+
+    return service;
 }
 
-void mdns_service_destroy(mdnsService *service) {
+// names and TXT records of a service that is not used any more
+static void free_service(mdnsService *service) {
+#if MDNS_STATIC_ALLOC
+    SERVICE_SLOT(service)->used = false;
+#else
     for (uint8_t i = 0; i < service->numTxtRecords; i++) {
         free(service->txtRecords[i].name);
         free(service->txtRecords[i].value);
     }
     free(service->txtRecords);
     free(service->name);
+    free(service->typeName);
+    free(service->instanceName);
     free(service);
+#endif
 }
 
+void mdns_service_destroy(mdnsService *service) {
+    // commands the task did not get to yet still point to the service, the task frees it then
+    taskENTER_CRITICAL();
+    bool busy = (service->pendingCommands > 0);
+    service->destroyPending = busy;
+    taskEXIT_CRITICAL();
 
-#if MDNS_ENABLE_PUBLISH
+    if (!busy) {
+        free_service(service);
+    }
+}
+
+// copy a TXT record for appending, returns false if it is ignored
+static bool copy_txt(mdnsService *service, char *key, char *value, mdnsTxtRecord *record) {
+    if (service->declaration) {
+        LOG(ERROR, "mdns: TXT records of %s are declared at build time, ignoring %s", service->name, key);
+        return false;
+    }
+
+    uint16_t keyLen = strlen(key);
+    uint16_t valueLen = strlen(value);
 
-void mdns_add_service(mdnsHandle *handle, mdnsService *service) {
+    // key=value is one character string, so it has a length byte (RFC 6763 section 6.1)
+    if (keyLen + 1 + valueLen > MDNS_MAX_TXT_LENGTH) {
+        LOG(ERROR, "mdns: TXT record %s too long, ignoring", key);
+        return false;
+    }
+
+#if MDNS_STATIC_ALLOC
+    // the caller claims the room, the task may not have appended the records before yet
+    mdnsServiceSlot *slot = SERVICE_SLOT(service);
+    if ((slot->txtReserved == MDNS_MAX_TXT_RECORDS) || (slot->txtUsed + keyLen + valueLen + 2 > MDNS_MAX_TXT_BYTES)) {
+        LOG(ERROR, "mdns: no room for TXT record %s, ignoring", key);
+        return false;
+    }
+    slot->txtReserved++;
+    record->name = copy_txt_string(slot, key, keyLen);
+    record->value = copy_txt_string(slot, value, valueLen);
+#else
+    record->name = strdup(key);
+    record->value = strdup(value);
+#endif
+    return true;
+}
+
+// give back the copy of a TXT record that was not appended
+static void release_txt(mdnsService *service, mdnsTxtRecord *record) {
+#if MDNS_STATIC_ALLOC
+    // it is the last one copied
+    mdnsServiceSlot *slot = SERVICE_SLOT(service);
+    slot->txtReserved--;
+    slot->txtUsed = record->name - slot->txt;
+#else
+    free(record->name);
+    free(record->value);
+#endif
+}
+
+void mdns_service_append_txt(mdnsService *service, mdnsTxtRecord *record) {
+#if !MDNS_STATIC_ALLOC
+    service->txtRecords = realloc(service->txtRecords, sizeof(mdnsTxtRecord) * (service->numTxtRecords + 1));
+#endif
+    service->txtRecords[service->numTxtRecords] = *record;
+    service->numTxtRecords++;
+
+    if (service->handle) {
+        mdns_response_cache_flush(service->handle);
+    }
+}
+
+// the task gets a command on the service, it is not freed before the task is done with it
+static void claim_service(mdnsService *service) {
+    taskENTER_CRITICAL();
+    service->pendingCommands++;
+    taskEXIT_CRITICAL();
+}
+
+void mdns_service_command_done(mdnsService *service) {
+    taskENTER_CRITICAL();
+    service->pendingCommands--;
+    bool destroy = service->destroyPending && (service->pendingCommands == 0);
+    taskEXIT_CRITICAL();
+
+    if (destroy) {
+        free_service(service);
+    }
+}
+
+bool mdns_service_add_txt(mdnsService *service, char *key, char *value) {
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionAddTxt;
+    message.txt.service = service;
+    if (!copy_txt(service, key, value, &message.txt.record)) {
+        return false;
+    }
+
+    if (service->owner == NULL) {
+        // nobody else works with the service
+        mdns_service_append_txt(service, &message.txt.record);
+        return true;
+    }
+
+    // the task may be sending the records right now
+    claim_service(service);
+    if (!mdns_run_command(service->owner, &message)) {
+        release_txt(service, &message.txt.record);
+        mdns_service_command_done(service);
+        return false;
+    }
+    return true;
+}
+
+bool mdns_service_attach(mdnsHandle *handle, mdnsService *service) {
+    // a service is in the index of one handle only, linking it twice would loop its bucket chain
+    if (service->handle != NULL) {
+        LOG(ERROR, "mdns: service %s was added already, ignoring", service->name);
+        return false;
+    }
+
+#if MDNS_STATIC_ALLOC
+    if (handle->numServices == MDNS_MAX_SERVICES) {
+        LOG(ERROR, "mdns: too many services, ignoring %s", service->name);
+        return false;
+    }
+#else
     if (handle->services) {
         handle->services = realloc(handle->services, sizeof(mdnsService *) * (handle->numServices + 1));
     } else {
         handle->services = malloc(sizeof(mdnsService *) * (handle->numServices + 1));
     }
+#endif
     handle->services[handle->numServices] = service;
     handle->numServices++;
+    service->handle = handle;
 
-    if (handle->started) {
-        xQueueSend(handle->mdnsQueue, (void *)mdnsTaskActionRestart, portMAX_DELAY);
-    }
+    // instance name depends on the hostname of the handle
+#if MDNS_STATIC_ALLOC
+    service->instanceName = mdns_make_fqdn(handle->hostname, service, SERVICE_SLOT(service)->instanceName, &service->instanceNameLen);
+#else
+    free(service->instanceName);
+    service->instanceName = mdns_make_fqdn(handle->hostname, service, NULL, &service->instanceNameLen);
+#endif
+    service->typeKey = mdns_service_type_key(service->nameHash, service->protocol);
+    service->instanceKey = mdns_service_instance_key(handle->hostnameHash, service->nameHash, service->protocol);
+    mdns_service_index_add(handle, service);
+
+    mdns_response_cache_flush(handle);
+    return true;
 }
 
-void mdns_remove_service(mdnsHandle *handle, mdnsService *service) {
-    for(uint8_t i = 0; i < handle->numServices; i++) {
-        if (handle->services[i] == service) {
-            for (uint8_t j = i + 1; j < handle->numServices - 1; j++) {
-                handle->services[i] = handle->services[j];
-            }
-        }
+bool mdns_service_detach(mdnsHandle *handle, mdnsService *service) {
+    uint8_t i = 0;
+    while ((i < handle->numServices) && (handle->services[i] != service)) {
+        i++;
+    }
+    if (i == handle->numServices) {
+        return false; // not added to this handle
+    }
+    for (; i < handle->numServices - 1; i++) {
+        handle->services[i] = handle->services[i + 1];
     }
-    handle->services = realloc(handle->services, sizeof(mdnsService *) * (handle->numServices - 1));
     handle->numServices--;
+#if !MDNS_STATIC_ALLOC
+    if (handle->numServices == 0) {
+        free(handle->services);
+        handle->services = NULL;
+    } else {
+        handle->services = realloc(handle->services, sizeof(mdnsService *) * handle->numServices);
+    }
+#endif
+    mdns_service_index_remove(handle, service);
+    service->handle = NULL;
+    service->queuedAnswers = 0;
+    service->queuedAdditionals = 0;
+    service->announce = 0;
+
+    mdns_response_cache_flush(handle);
+    return true;
+}
+
+bool mdns_add_service(mdnsHandle *handle, mdnsService *service) {
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionAddService;
+    message.service = service;
+
+    claim_service(service);
+    if (!mdns_run_command(handle, &message)) {
+        mdns_service_command_done(service);
+        return false;
+    }
+
+    // TXT records added from now on go through the task as well
+    service->owner = handle;
+    return true;
+}
+
+bool mdns_remove_service(mdnsHandle *handle, mdnsService *service) {
+    // the owner stays, the task may still send the records until it gets to the command
+    mdnsTaskMessage message = { 0 };
+    message.action = mdnsTaskActionRemoveService;
+    message.service = service;
 
-    if (handle->started) {
-        xQueueSend(handle->mdnsQueue, (void *)mdnsTaskActionRestart, portMAX_DELAY);    
+    claim_service(service);
+    if (!mdns_run_command(handle, &message)) {
+        mdns_service_command_done(service);
+        return false;
     }
+    return true;
 }
 
 #endif /* MDNS_ENABLE_PUBLISH */
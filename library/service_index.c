@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include <mdns/mdns.h>
+#include "service_index.h"
+
+#include "server.h"
+#include "tools.h"
+
+#if MDNS_ENABLE_PUBLISH
+
+//
+// private
+//
+
+static inline uint8_t bucket(uint32_t key) {
+    return key & (MDNS_SERVICE_INDEX_SIZE - 1);
+}
+
+static inline uint32_t protocol_hash(mdnsProtocol protocol) {
+    return (protocol == mdnsProtocolTCP) ? MDNS_HASH_TCP : MDNS_HASH_UDP;
+}
+
+//
+// API
+//
+
+uint32_t mdns_service_type_key(uint32_t nameHash, mdnsProtocol protocol) {
+    uint32_t key = mdns_hash_combine(MDNS_HASH_INIT, nameHash);
+    return mdns_hash_combine(key, protocol_hash(protocol));
+}
+
+uint32_t mdns_service_instance_key(uint32_t hostnameHash, uint32_t nameHash, mdnsProtocol protocol) {
+    uint32_t key = mdns_hash_combine(MDNS_HASH_INIT, hostnameHash);
+    key = mdns_hash_combine(key, nameHash);
+    return mdns_hash_combine(key, protocol_hash(protocol));
+}
+
+void mdns_service_index_add(mdnsHandle *handle, mdnsService *service) {
+    mdnsService **types = &handle->serviceIndex.types[bucket(service->typeKey)];
+    service->nextType = *types;
+    *types = service;
+
+    mdnsService **instances = &handle->serviceIndex.instances[bucket(service->instanceKey)];
+    service->nextInstance = *instances;
+    *instances = service;
+}
+
+void mdns_service_index_remove(mdnsHandle *handle, mdnsService *service) {
+    mdnsService **ptr = &handle->serviceIndex.types[bucket(service->typeKey)];
+    while (*ptr != NULL) {
+        if (*ptr == service) {
+            *ptr = service->nextType;
+            break;
+        }
+        ptr = &(*ptr)->nextType;
+    }
+
+    ptr = &handle->serviceIndex.instances[bucket(service->instanceKey)];
+    while (*ptr != NULL) {
+        if (*ptr == service) {
+            *ptr = service->nextInstance;
+            break;
+        }
+        ptr = &(*ptr)->nextInstance;
+    }
+
+    service->nextType = NULL;
+    service->nextInstance = NULL;
+}
+
+mdnsService *mdns_service_index_find_type(mdnsHandle *handle, uint32_t key, mdnsService *previous) {
+    mdnsService *service = previous ? previous->nextType : handle->serviceIndex.types[bucket(key)];
+    while ((service != NULL) && (service->typeKey != key)) {
+        service = service->nextType;
+    }
+    return service;
+}
+
+mdnsService *mdns_service_index_find_instance(mdnsHandle *handle, uint32_t key, mdnsService *previous) {
+    mdnsService *service = previous ? previous->nextInstance : handle->serviceIndex.instances[bucket(key)];
+    while ((service != NULL) && (service->instanceKey != key)) {
+        service = service->nextInstance;
+    }
+    return service;
+}
+
+#endif /* MDNS_ENABLE_PUBLISH */
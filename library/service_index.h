@@ -0,0 +1,38 @@
+#ifndef mdns_service_index_h_included
+#define mdns_service_index_h_included
+
+#include <mdns/mdns.h>
+
+#if MDNS_ENABLE_PUBLISH
+
+// Number of buckets in the service lookup index, has to be a power of two
+#ifndef MDNS_SERVICE_INDEX_SIZE
+#define MDNS_SERVICE_INDEX_SIZE 16
+#endif
+
+// Service lookup index, services are chained into the buckets by their keys
+typedef struct _mdnsServiceIndex {
+    mdnsService *types[MDNS_SERVICE_INDEX_SIZE];     // keyed by _type._protocol
+    mdnsService *instances[MDNS_SERVICE_INDEX_SIZE]; // keyed by hostname._type._protocol
+} mdnsServiceIndex;
+
+// key of a service type, folded case insensitive hashes of the type and protocol labels
+uint32_t mdns_service_type_key(uint32_t nameHash, mdnsProtocol protocol);
+
+// key of a service instance, folded case insensitive hashes of the hostname, type and protocol labels
+uint32_t mdns_service_instance_key(uint32_t hostnameHash, uint32_t nameHash, mdnsProtocol protocol);
+
+// add a service to the index, the keys of the service have to be set
+void mdns_service_index_add(mdnsHandle *handle, mdnsService *service);
+
+// remove a service from the index
+void mdns_service_index_remove(mdnsHandle *handle, mdnsService *service);
+
+// candidates for a type or instance key, pass NULL to get the first one and the
+// last result to get the next. Keys may collide, so compare the names before use.
+mdnsService *mdns_service_index_find_type(mdnsHandle *handle, uint32_t key, mdnsService *previous);
+mdnsService *mdns_service_index_find_instance(mdnsHandle *handle, uint32_t key, mdnsService *previous);
+
+#endif /* MDNS_ENABLE_PUBLISH */
+
+#endif /* mdns_service_index_h_included */
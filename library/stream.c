@@ -1,27 +1,282 @@
 #include "stream.h"
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 
 #include "platform.h"
+#include "tools.h"
+
+// maximum number of compressed pointers followed in one name
+#define MDNS_MAX_POINTER_DEPTH 8
+
+// maximum length of a name in wire format (RFC 1035 section 3.1)
+#define MDNS_MAX_NAME_LENGTH 255
+
+//
+// API
+//
 
 // read 16 bit int from stream
 uint16_t mdns_stream_read16(mdnsStreamBuf *buffer) {
-    return (mdns_stream_read8(buffer) << 8) \
-            + mdns_stream_read8(buffer);
+    uint8_t data[2] = { 0 };
+    mdns_stream_read_bytes(buffer, data, 2);
+    return (data[0] << 8) + data[1];
 }
 
 // read 32 bit int from stream
 uint32_t mdns_stream_read32(mdnsStreamBuf *buffer) {
-        return (mdns_stream_read8(buffer) << 24) \
-            + (mdns_stream_read8(buffer) << 16) \
-            + (mdns_stream_read8(buffer) << 8) \
-            + mdns_stream_read8(buffer);
+    uint8_t data[4] = { 0 };
+    mdns_stream_read_bytes(buffer, data, 4);
+    return ((uint32_t)data[0] << 24) \
+        + ((uint32_t)data[1] << 16) \
+        + ((uint32_t)data[2] << 8) \
+        + data[3];
 }
 
+#if !MDNS_STATIC_ALLOC
 // caller has to free response
 char *mdns_stream_read_string(mdnsStreamBuf *buffer, uint16_t len) {
     char *result = malloc(len + 1);
-    for (uint8_t i = 0; i < len; i++) {
-        result[i] = mdns_stream_read8(buffer);
+    uint16_t bytesRead = mdns_stream_read_bytes(buffer, result, len);
+    result[bytesRead] = '\0';
+
+    return result;
+}
+#endif
+
+// skip over a DNS name, returns false if the name is malformed
+bool mdns_stream_skip_name(mdnsStreamBuf *buffer) {
+    uint16_t length = 0;
+
+    while (true) {
+        uint8_t len = mdns_stream_read8(buffer);
+        if (len == 0) {
+            return true;
+        }
+        if ((len & 0xC0) == 0xC0) { // compressed pointer terminates the name
+            (void)mdns_stream_read8(buffer);
+            return true;
+        }
+        if (len & 0xC0) {
+            return false; // extended label types are not supported
+        }
+
+        length += len + 1;
+        if (length > MDNS_MAX_NAME_LENGTH) {
+            return false;
+        }
+        if (!mdns_stream_skip(buffer, len)) {
+            return false;
+        }
+    }
+}
+
+// hash the next len bytes
+uint32_t mdns_stream_hash_label(mdnsStreamBuf *buffer, uint8_t len) {
+    uint32_t hash = MDNS_HASH_INIT;
+
+    while (len > 0) {
+        uint16_t available = 0;
+        const uint8_t *span = mdns_stream_peek_span(buffer, &available);
+        if (span == NULL) {
+            break;
+        }
+        if (available > len) {
+            available = len;
+        }
+
+        for (uint16_t i = 0; i < available; i++) {
+            hash = mdns_hash_step(hash, span[i]);
+        }
+        mdns_stream_skip(buffer, available);
+        len -= available;
+    }
+
+    return hash;
+}
+
+// compare the label at offset case insensitively
+bool mdns_stream_match_label(mdnsStreamBuf *buffer, uint16_t offset, const char *label, uint8_t len) {
+    if (!mdns_stream_seek(buffer, offset)) {
+        return false;
+    }
+
+    while (len > 0) {
+        uint16_t available = 0;
+        const uint8_t *span = mdns_stream_peek_span(buffer, &available);
+        if (span == NULL) {
+            return false;
+        }
+        if (available > len) {
+            available = len;
+        }
+
+        for (uint16_t i = 0; i < available; i++) {
+            if (tolower(span[i]) != tolower((uint8_t)label[i])) {
+                return false;
+            }
+        }
+        mdns_stream_skip(buffer, available);
+        label += available;
+        len -= available;
+    }
+
+    return true;
+}
+
+// compare the next len bytes with data exactly
+bool mdns_stream_match_bytes(mdnsStreamBuf *buffer, const void *data, uint16_t len) {
+    const uint8_t *ptr = data;
+
+    while (len > 0) {
+        uint16_t available = 0;
+        const uint8_t *span = mdns_stream_peek_span(buffer, &available);
+        if (span == NULL) {
+            return false;
+        }
+        if (available > len) {
+            available = len;
+        }
+
+        if (memcmp(span, ptr, available) != 0) {
+            return false;
+        }
+        mdns_stream_skip(buffer, available);
+        ptr += available;
+        len -= available;
+    }
+
+    return true;
+}
+
+// read DNS name as dotted string
+bool mdns_stream_read_name(mdnsStreamBuf *buffer, char *name, uint16_t maxLen) {
+    mdnsNameIterator iterator;
+    mdns_name_iterator_init(&iterator, buffer);
+
+    uint16_t nameLen = 0;
+    while (true) {
+        int16_t len = mdns_name_iterator_next(&iterator);
+        if (len < 0) {
+            return false;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        if ((nameLen > 0) && (nameLen < maxLen - 1)) {
+            name[nameLen++] = '.';
+        }
+
+        // copy what fits, the iterator skips the rest
+        uint16_t room = maxLen - 1 - nameLen;
+        nameLen += mdns_stream_read_bytes(buffer, name + nameLen, (len < room) ? len : room);
+    }
+    name[nameLen] = '\0';
+
+    return mdns_name_iterator_finish(&iterator);
+}
+
+uint8_t mdns_stream_name_length(mdnsStreamBuf *buffer) {
+    uint16_t offset = mdns_stream_tell(buffer);
+    mdnsNameIterator iterator;
+    mdns_name_iterator_init(&iterator, buffer);
+
+    bool valid = mdns_name_iterator_finish(&iterator);
+    mdns_stream_seek(buffer, offset);
+
+    return valid ? iterator.length : 0;
+}
+
+bool mdns_stream_read_wire_name(mdnsStreamBuf *buffer, char *name) {
+    mdnsNameIterator iterator;
+    mdns_name_iterator_init(&iterator, buffer);
+
+    while (true) {
+        int16_t len = mdns_name_iterator_next(&iterator);
+        if (len < 0) {
+            return false;
+        }
+
+        *name++ = len;
+        if (len == 0) {
+            break;
+        }
+        name += mdns_stream_read_bytes(buffer, name, len);
+    }
+
+    return mdns_name_iterator_finish(&iterator);
+}
+
+// start walking the name at the current read position
+void mdns_name_iterator_init(mdnsNameIterator *iterator, mdnsStreamBuf *buffer) {
+    iterator->buffer = buffer;
+    iterator->next = mdns_stream_tell(buffer);
+    iterator->resume = 0;
+    iterator->limit = iterator->next;
+    iterator->length = 0;
+    iterator->depth = 0;
+}
+
+// returns the length of the next label
+int16_t mdns_name_iterator_next(mdnsNameIterator *iterator) {
+    if (iterator->next == 0) {
+        return 0; // already at the end of the name
+    }
+
+    // the caller may or may not have consumed the last label
+    if (!mdns_stream_seek(iterator->buffer, iterator->next)) {
+        return -1;
+    }
+    uint8_t len = mdns_stream_read8(iterator->buffer);
+
+    while ((len & 0xC0) == 0xC0) {
+        uint16_t target = ((len & 0x3f) << 8) + mdns_stream_read8(iterator->buffer);
+        if (iterator->depth == 0) {
+            iterator->resume = mdns_stream_tell(iterator->buffer);
+        }
+
+        // only allow pointers strictly backwards, this rules out loops
+        if ((++iterator->depth > MDNS_MAX_POINTER_DEPTH) || (target >= iterator->limit)) {
+            return -1;
+        }
+        if (!mdns_stream_seek(iterator->buffer, target)) {
+            return -1;
+        }
+        iterator->limit = target;
+        len = mdns_stream_read8(iterator->buffer);
+    }
+
+    if (len & 0xC0) {
+        return -1; // extended label types are not supported
+    }
+
+    iterator->length += len + 1;
+    if (iterator->length > MDNS_MAX_NAME_LENGTH) {
+        return -1;
+    }
+
+    if (len == 0) {
+        iterator->next = 0; // header is at offset zero, so this can not be a label
+        if (iterator->depth == 0) {
+            iterator->resume = mdns_stream_tell(iterator->buffer);
+        }
+    } else {
+        iterator->next = mdns_stream_tell(iterator->buffer) + len;
+    }
+
+    return len;
+}
+
+// skip the remaining labels and move the read position behind the name
+bool mdns_name_iterator_finish(mdnsNameIterator *iterator) {
+    int16_t len;
+    do {
+        len = mdns_name_iterator_next(iterator);
+    } while (len > 0);
+
+    if (len < 0) {
+        return false;
     }
-    result[len] = '\0';
+    return mdns_stream_seek(iterator->buffer, iterator->resume);
 }
@@ -1,26 +1,88 @@
 #ifndef mdns_stream_h_included
 #define mdns_stream_h_included
 
+#include <stdbool.h>
 #include "platform.h"
 
 typedef struct _mdnsStreamBuf mdnsStreamBuf;
 
-// create stream reader (this is implemented in libplatform)
-mdnsStreamBuf *mdns_stream_new(mdnsNetworkBuffer *buffer);
+// initialize stream reader, the network buffer has to stay valid while reading (this is implemented in libplatform)
+void mdns_stream_init(mdnsStreamBuf *stream, mdnsNetworkBuffer *buffer);
 
 // read byte from stream (this is implemented in libplatform)
 uint8_t mdns_stream_read8(mdnsStreamBuf *buffer);
 
+// read len bytes into dst, returns number of bytes read (this is implemented in libplatform)
+uint16_t mdns_stream_read_bytes(mdnsStreamBuf *buffer, void *dst, uint16_t len);
+
+// skip len bytes, returns false if that would move behind the end of the packet (this is implemented in libplatform)
+bool mdns_stream_skip(mdnsStreamBuf *buffer, uint16_t len);
+
+// returns a pointer to the bytes at the read position and the number of bytes that are
+// contiguous in memory, NULL at the end of the packet. Does not move the read position
+// (this is implemented in libplatform)
+const uint8_t *mdns_stream_peek_span(mdnsStreamBuf *buffer, uint16_t *len);
+
 // read 16 bit int from stream
 uint16_t mdns_stream_read16(mdnsStreamBuf *buffer);
 
 // read 32 bit int from stream
 uint32_t mdns_stream_read32(mdnsStreamBuf *buffer);
 
+#if !MDNS_STATIC_ALLOC
 // caller has to free response
 char *mdns_stream_read_string(mdnsStreamBuf *buffer, uint16_t len);
+#endif
+
+// offset of the read position from the start of the packet (this is implemented in libplatform)
+uint16_t mdns_stream_tell(mdnsStreamBuf *buffer);
+
+// move read position to offset from the start of the packet (this is implemented in libplatform)
+bool mdns_stream_seek(mdnsStreamBuf *buffer, uint16_t offset);
+
+// skip over a DNS name, returns false if the name is malformed
+bool mdns_stream_skip_name(mdnsStreamBuf *buffer);
+
+// hash the next len bytes with mdns_hash_step
+uint32_t mdns_stream_hash_label(mdnsStreamBuf *buffer, uint8_t len);
+
+// compare the label at offset case insensitively, moves the read position
+bool mdns_stream_match_label(mdnsStreamBuf *buffer, uint16_t offset, const char *label, uint8_t len);
+
+// compare the next len bytes with data exactly, moves the read position
+bool mdns_stream_match_bytes(mdnsStreamBuf *buffer, const void *data, uint16_t len);
+
+// read DNS name as dotted string into name, follows compressed pointers,
+// truncates names longer than maxLen - 1, returns false if the name is malformed
+bool mdns_stream_read_name(mdnsStreamBuf *buffer, char *name, uint16_t maxLen);
+
+// length of the name at the read position in uncompressed wire format including the
+// terminator, does not move the read position, returns 0 if the name is malformed
+uint8_t mdns_stream_name_length(mdnsStreamBuf *buffer);
+
+// read the name in uncompressed wire format, name needs mdns_stream_name_length bytes,
+// returns false if the name is malformed
+bool mdns_stream_read_wire_name(mdnsStreamBuf *buffer, char *name);
+
+// walks the labels of a name in place, following compressed pointers
+typedef struct _mdnsNameIterator {
+    mdnsStreamBuf *buffer;
+    uint16_t next;   // offset of the next label, zero at the end of the name
+    uint16_t resume; // read position after the name, valid once a pointer was followed or the name ended
+    uint16_t limit;  // pointers have to point before this offset
+    uint16_t length; // length of the name in wire format
+    uint8_t depth;   // number of pointers followed
+} mdnsNameIterator;
+
+// start walking the name at the current read position
+void mdns_name_iterator_init(mdnsNameIterator *iterator, mdnsStreamBuf *buffer);
+
+// returns the length of the next label and moves the read position to its first
+// character, 0 at the end of the name or -1 if the name is malformed
+int16_t mdns_name_iterator_next(mdnsNameIterator *iterator);
 
-// destroy stream reader (this is implemented in libplatform)
-void mdns_stream_destroy(mdnsStreamBuf *buffer);
+// skip the remaining labels and move the read position behind the name,
+// returns false if the name is malformed
+bool mdns_name_iterator_finish(mdnsNameIterator *iterator);
 
 #endif /* mdns_stream_h_included */
\ No newline at end of file
@@ -1,26 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "tools.h"
 #include "server.h"
 
-// Build DNS-SD service name: _type._protocol.local
-char *mdns_make_service_name(mdnsService *service) {
-    const uint8_t size = strlen(service->name) + 1 + 4 + 1 + 5 + 1;
-    char *buffer = malloc(size);
-    sprintf(buffer, "%s._%s.local", service->name, service->protocol == mdnsProtocolTCP ? "tcp" : "udp");
-    return buffer;
+// hash a label
+uint32_t mdns_label_hash(const char *label, uint8_t len) {
+    uint32_t hash = MDNS_HASH_INIT;
+    for (uint8_t i = 0; i < len; i++) {
+        hash = mdns_hash_step(hash, label[i]);
+    }
+    return hash;
 }
 
-// Build DNS-SD FQDN: Hostname._type._protocol.local
-char *mdns_make_fqdn(char *hostname, mdnsService *service) {
-    const uint8_t size = strlen(hostname) + 1 + strlen(service->name) + 1 + 4 + 1 + 5 + 1;
-    char *buffer = malloc(size);
-    sprintf(buffer, "%s.%s._%s.local", hostname, service->name, service->protocol == mdnsProtocolTCP ? "tcp" : "udp");
-    return buffer;
+uint32_t mdns_name_key(const char *name) {
+    uint32_t key = MDNS_HASH_INIT;
+    for (; *name; name += *name + 1) {
+        key = mdns_hash_combine(key, mdns_label_hash(name + 1, *name));
+    }
+    return key;
 }
 
-// Build local hostname: Hostname.local
-char *mdns_make_local(char *hostname) {
-    const uint8_t size = strlen(hostname) + 1 + 5 + 1;
-    char *buffer = malloc(size);
-    sprintf(buffer, "%s.local", hostname);
+// build a name in wire format from a list of labels
+static char *make_wire_name(const char **labels, uint8_t numLabels, char *bufferOrNull, uint8_t *len) {
+    uint16_t size = 1; // terminator
+    for (uint8_t i = 0; i < numLabels; i++) {
+        uint8_t labelLen = strlen(labels[i]);
+        size += 1 + ((labelLen > MDNS_MAX_LABEL_LENGTH) ? MDNS_MAX_LABEL_LENGTH : labelLen);
+    }
+
+    char *buffer = bufferOrNull;
+#if !MDNS_STATIC_ALLOC
+    if (buffer == NULL) {
+        buffer = malloc(size);
+    }
+#endif
+    char *ptr = buffer;
+    for (uint8_t i = 0; i < numLabels; i++) {
+        uint8_t labelLen = strlen(labels[i]);
+        if (labelLen > MDNS_MAX_LABEL_LENGTH) {
+            labelLen = MDNS_MAX_LABEL_LENGTH;
+        }
+        *ptr++ = labelLen;
+        memcpy(ptr, labels[i], labelLen);
+        ptr += labelLen;
+    }
+    *ptr++ = 0; // terminator
+
+    *len = size;
     return buffer;
 }
+
+// Build DNS-SD service type name in wire format: _type._protocol.local
+char *mdns_make_type_name(const char *type, mdnsProtocol protocol, char *bufferOrNull, uint8_t *len) {
+    const char *labels[] = { type, protocol == mdnsProtocolTCP ? "_tcp" : "_udp", "local" };
+    return make_wire_name(labels, 3, bufferOrNull, len);
+}
+
+// Build DNS-SD service name in wire format: _type._protocol.local
+char *mdns_make_service_name(mdnsService *service, char *bufferOrNull, uint8_t *len) {
+    return mdns_make_type_name(service->name, service->protocol, bufferOrNull, len);
+}
+
+// Build DNS-SD FQDN in wire format: Hostname._type._protocol.local
+char *mdns_make_fqdn(char *hostname, mdnsService *service, char *bufferOrNull, uint8_t *len) {
+    const char *labels[] = { hostname, service->name, service->protocol == mdnsProtocolTCP ? "_tcp" : "_udp", "local" };
+    return make_wire_name(labels, 4, bufferOrNull, len);
+}
+
+// Build local hostname in wire format: Hostname.local
+char *mdns_make_local(char *hostname, char *bufferOrNull, uint8_t *len) {
+    const char *labels[] = { hostname, "local" };
+    return make_wire_name(labels, 2, bufferOrNull, len);
+}
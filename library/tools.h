@@ -2,15 +2,73 @@
 #define mdns_tools_h_included
 
 #include <mdns/mdns.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 #include "platform.h"
 
-// Build DNS-SD service name: _type._protocol.local
-char *mdns_make_service_name(mdnsService *service);
+// Case insensitive FNV-1a hash of DNS labels
+#define MDNS_HASH_INIT 2166136261u
 
-// Build DNS-SD FQDN: Hostname._type._protocol.local
-char *mdns_make_fqdn(char *hostname, mdnsService *service);
+// precalculated hashes of the fixed labels
+#define MDNS_HASH_LOCAL 0x9c436708u // "local"
+#define MDNS_HASH_TCP 0x59837685u   // "_tcp"
+#define MDNS_HASH_UDP 0xd8525c9du   // "_udp"
 
-// Build local hostname: Hostname.local
-char *mdns_make_local(char *hostname);
+// add one character to a label hash
+static inline uint32_t mdns_hash_step(uint32_t hash, char c) {
+    return (hash ^ (uint8_t)tolower((uint8_t)c)) * 16777619u;
+}
+
+// fold a label hash into the hash of a name
+static inline uint32_t mdns_hash_combine(uint32_t hash, uint32_t labelHash) {
+    return (hash ^ labelHash) * 16777619u;
+}
+
+// hash a label
+uint32_t mdns_label_hash(const char *label, uint8_t len);
+
+// key of a wire format name, folded hashes of its labels
+uint32_t mdns_name_key(const char *name);
+
+// milliseconds since boot
+static inline uint32_t mdns_now(void) {
+    return xTaskGetTickCount() * portTICK_RATE_MS;
+}
+
+// random number in [min, max]
+static inline uint32_t mdns_random(uint32_t min, uint32_t max) {
+    return min + (rand() % (max - min + 1));
+}
+
+// copy len bytes of constant data from flash, which can only be read in aligned
+// 32 bit words on the ESP8266 (this is implemented in libplatform)
+void mdns_flash_read(void *dst, const void *src, uint16_t len);
+
+// Maximum length of a TXT record string
+#define MDNS_MAX_TXT_LENGTH 255
+
+// Maximum length of a label, longer names are truncated
+#define MDNS_MAX_LABEL_LENGTH 63
+
+// Maximum lengths of the wire format names below, including the terminator
+#define MDNS_MAX_LOCAL_NAME_LENGTH (1 + MDNS_MAX_LABEL_LENGTH + 7)
+#define MDNS_MAX_TYPE_NAME_LENGTH (1 + MDNS_MAX_LABEL_LENGTH + 12)
+#define MDNS_MAX_FQDN_LENGTH (1 + MDNS_MAX_LABEL_LENGTH + MDNS_MAX_TYPE_NAME_LENGTH)
+
+// The builders write into bufferOrNull, or allocate the name if it is NULL
+
+// Build DNS-SD service type name in wire format: _type._protocol.local
+char *mdns_make_type_name(const char *type, mdnsProtocol protocol, char *bufferOrNull, uint8_t *len);
+
+// Build DNS-SD service name in wire format: _type._protocol.local
+char *mdns_make_service_name(mdnsService *service, char *bufferOrNull, uint8_t *len);
+
+// Build DNS-SD FQDN in wire format: Hostname._type._protocol.local
+char *mdns_make_fqdn(char *hostname, mdnsService *service, char *bufferOrNull, uint8_t *len);
+
+// Build local hostname in wire format: Hostname.local
+char *mdns_make_local(char *hostname, char *bufferOrNull, uint8_t *len);
 
 #endif /* mdns_tools_h_included */
\ No newline at end of file
@@ -14,8 +14,18 @@ typedef struct udp_pcb mdnsUDPHandle;
 typedef struct pbuf mdnsNetworkBuffer;
 
 struct _mdnsStreamBuf {
-    struct pbuf *bufList;
-    uint16_t currentPosition;
+    struct pbuf *packet;      // first pbuf of the packet, compressed names point into it
+    struct pbuf *bufList;     // pbuf we are currently reading from
+    uint16_t currentPosition; // read position in bufList
+    uint16_t bufferOffset;    // offset of bufList from the start of the packet
+};
+
+struct _mdnsSendBuffer {
+#if MDNS_STATIC_ALLOC
+    uint8_t slot;        // static send buffer the response is written into, sent from in place
+#else
+    struct pbuf *packet; // PBUF_TRANSPORT pbuf, responses are written into its payload
+#endif
 };
 
 #endif /* mdns_platform_h_included */
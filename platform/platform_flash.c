@@ -0,0 +1,22 @@
+#include "platform.h"
+
+#include "tools.h"
+
+//
+// API
+//
+
+void mdns_flash_read(void *dst, const void *src, uint16_t len) {
+    // flash is mapped into the address space, but byte loads from it fault
+    const uint32_t *word = (const uint32_t *)((uintptr_t)src & ~3);
+    uint8_t skip = (uintptr_t)src & 3;
+    uint8_t *ptr = dst;
+
+    while (len > 0) {
+        uint32_t value = *word++;
+        for (uint8_t i = skip; (i < 4) && (len > 0); i++, len--) {
+            *ptr++ = value >> (8 * i); // little endian
+        }
+        skip = 0;
+    }
+}
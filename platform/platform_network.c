@@ -7,6 +7,8 @@
 
 #include <lwip/igmp.h>
 #include <esp_common.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 //
 // private
@@ -18,14 +20,8 @@ void mdns_recv_callback(void *arg, struct udp_pcb *pcb, struct pbuf *buf, ip_add
 
     LOG(TRACE, "mdns: received %d bytes of data", buf->len);
 
-    // make a stream buffer
-    mdnsStreamBuf *buffer = mdns_stream_new(buf);
-
-    // call parser
-    mdns_parse_packet(handle, buffer, ip, port);
-
-    // clean up our stream reader
-    mdns_stream_destroy(buffer);
+    // we own the pbuf handed to the receive callback, the mdns task parses and frees it
+    mdns_receive_packet(handle, buf, ip, port);
 }
 #endif /* MDNS_BROADCAST_ONLY */
 
@@ -88,22 +84,116 @@ mdnsUDPHandle *mdns_listen(mdnsHandle *handle) {
 
 }
 
-uint16_t mdns_send_udp_packet(mdnsHandle *handle, char *data, uint16_t len) {
-    struct pbuf * buf = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-    if (pbuf_take(buf, data, len) != ERR_OK) {
-        LOG(ERROR, "mdns: pbuf not big enough");
+#if MDNS_STATIC_ALLOC
+// send buffers, claimed by the application and the mdns task. A slot is sent in place, lwip may
+// still hold its pbuf after sending, like the WiFi driver until the frame is out, so the slot
+// keeps a reference and is only claimed again once it is the last one.
+static uint32_t sendBuffers[MDNS_SEND_BUFFERS][(MDNS_MAX_PACKET_SIZE + 3) / 4];
+static struct pbuf *sendBufferPackets[MDNS_SEND_BUFFERS];
+static volatile bool sendBufferUsed[MDNS_SEND_BUFFERS];
+#endif
+
+char *mdns_send_buffer_acquire(mdnsSendBuffer *buffer, uint16_t maxLen) {
+#if MDNS_STATIC_ALLOC
+    if (maxLen > MDNS_MAX_PACKET_SIZE) {
+        return NULL;
     }
 
-    // HEXDUMP(DEBUG, "mdns: UDP Packet", data, len);
-    // LOG(TRACE, "mdns: sending packet (%d bytes)", len);
+    taskENTER_CRITICAL();
+    uint8_t slot = 0;
+    while ((slot < MDNS_SEND_BUFFERS) &&
+           (sendBufferUsed[slot] || (sendBufferPackets[slot] && (sendBufferPackets[slot]->ref > 1)))) {
+        slot++;
+    }
+    struct pbuf *sent = NULL;
+    if (slot < MDNS_SEND_BUFFERS) {
+        sendBufferUsed[slot] = true;
+        sent = sendBufferPackets[slot];
+        sendBufferPackets[slot] = NULL;
+    }
+    taskEXIT_CRITICAL();
 
-    // actually send it
-    udp_send(handle->pcb, buf);
-    
-    pbuf_free(buf);
-    free(data);
-    return len;
+    if (slot == MDNS_SEND_BUFFERS) {
+        LOG(ERROR, "mdns: no free send buffer");
+        return NULL;
+    }
+    if (sent != NULL) {
+        // lwip let go of the last packet sent from the slot
+        pbuf_free(sent);
+    }
+    buffer->slot = slot;
+    return (char *)sendBuffers[slot];
+#else
+    // PBUF_RAM is one contiguous allocation, so the payload can be written to directly
+    buffer->packet = pbuf_alloc(PBUF_TRANSPORT, maxLen, PBUF_RAM);
+    if (buffer->packet == NULL) {
+        LOG(ERROR, "mdns: could not allocate send buffer");
+        return NULL;
+    }
+
+    return buffer->packet->payload;
+#endif
+}
+
+// send the first len bytes of the buffer to the multicast group or to ipOrNull, then release it
+static void send_buffer(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len, ip_addr_t *ipOrNull, uint16_t port) {
+#if MDNS_STATIC_ALLOC
+    // the slot is sent in place, a PBUF_REF pbuf is taken from lwip's pbuf pool and not its heap.
+    // lwip copies it where it has to keep the payload, like in the ARP queue.
+    struct pbuf *packet = NULL;
+    if (len > 0) {
+        packet = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_REF);
+    }
+    if (packet != NULL) {
+        packet->payload = sendBuffers[buffer->slot];
+    }
+#else
+    struct pbuf *packet = buffer->packet;
+    buffer->packet = NULL;
+    if (len == 0) {
+        pbuf_free(packet);
+        return;
+    }
+
+    // give back the unused tail of the buffer
+    pbuf_realloc(packet, len);
+#endif
+
+    if (packet != NULL) {
+        // HEXDUMP(DEBUG, "mdns: UDP Packet", packet->payload, len);
+        // LOG(TRACE, "mdns: sending packet (%d bytes)", len);
+
+        // actually send it, the pcb stays connected to the multicast group and sendto only overrides the destination
+        if (ipOrNull) {
+            udp_sendto(handle->pcb, packet, ipOrNull, port);
+        } else {
+            udp_send(handle->pcb, packet);
+        }
+#if !MDNS_STATIC_ALLOC
+        pbuf_free(packet);
+#endif
+    }
+
+#if MDNS_STATIC_ALLOC
+    // our reference stays with the slot until it is claimed again
+    sendBufferPackets[buffer->slot] = packet;
+    sendBufferUsed[buffer->slot] = false;
+#endif
+}
+
+void mdns_send_buffer_commit(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len) {
+    send_buffer(handle, buffer, len, NULL, 0);
+}
+
+#if !MDNS_BROADCAST_ONLY
+void mdns_send_buffer_commit_to(mdnsHandle *handle, mdnsSendBuffer *buffer, uint16_t len, ip_addr_t *ip, uint16_t port) {
+    send_buffer(handle, buffer, len, ip, port);
+}
+
+void mdns_network_buffer_free(mdnsNetworkBuffer *packet) {
+    pbuf_free(packet);
 }
+#endif /* !MDNS_BROADCAST_ONLY */
 
 void mdns_shutdown_socket(mdnsUDPHandle *pcb) {
     LOG(TRACE, "mdns: shutting down socket");
@@ -12,38 +12,111 @@ static bool mdns_advance_buffer(mdnsStreamBuf *buffer) {
     if (next == NULL) {
         return false;
     }
-    pbuf_ref(next);
-    pbuf_free(buffer->bufList);
+    buffer->bufferOffset += buffer->bufList->len;
+    buffer->currentPosition -= buffer->bufList->len;
     buffer->bufList = next;
-    buffer->currentPosition = 0;
 
     return true;
 }
 
+// make sure the read position points into a pbuf, returns false at the end of the packet
+static inline bool mdns_normalize_buffer(mdnsStreamBuf *buffer) {
+    while (buffer->currentPosition >= buffer->bufList->len) {
+        if (!mdns_advance_buffer(buffer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 //
 // API
 //
 
-// create stream reader
-mdnsStreamBuf *mdns_stream_new(mdnsNetworkBuffer *buffer) {
-    mdnsStreamBuf *buf = malloc(sizeof(mdnsStreamBuf));
-    pbuf_ref(buffer);
-
-    buf->bufList = buffer;
-    buf->currentPosition = 0;
+// initialize stream reader
+void mdns_stream_init(mdnsStreamBuf *stream, mdnsNetworkBuffer *buffer) {
+    stream->packet = buffer;
+    stream->bufList = buffer;
+    stream->currentPosition = 0;
+    stream->bufferOffset = 0;
 }
 
 // read byte from stream
 uint8_t mdns_stream_read8(mdnsStreamBuf *buffer) {
-    if (buffer->currentPosition >= buffer->bufList->len - 1) {
-        mdns_advance_buffer(buffer);
+    if (!mdns_normalize_buffer(buffer)) {
+        return 0; // end of packet
     }
-    char *payload = buffer->bufList->payload;
+    uint8_t *payload = buffer->bufList->payload;
     return payload[buffer->currentPosition++];
 }
 
-// destroy stream reader
-void mdns_stream_destroy(mdnsStreamBuf *buffer) {
-    pbuf_free(buffer->bufList);
-    free(buffer);
+// read len bytes into dst
+uint16_t mdns_stream_read_bytes(mdnsStreamBuf *buffer, void *dst, uint16_t len) {
+    uint8_t *ptr = dst;
+    uint16_t bytesRead = 0;
+
+    while ((bytesRead < len) && mdns_normalize_buffer(buffer)) {
+        uint16_t chunk = buffer->bufList->len - buffer->currentPosition;
+        if (chunk > len - bytesRead) {
+            chunk = len - bytesRead;
+        }
+        memcpy(ptr + bytesRead, (uint8_t *)buffer->bufList->payload + buffer->currentPosition, chunk);
+        buffer->currentPosition += chunk;
+        bytesRead += chunk;
+    }
+
+    return bytesRead;
+}
+
+// skip len bytes
+bool mdns_stream_skip(mdnsStreamBuf *buffer, uint16_t len) {
+    if ((uint32_t)mdns_stream_tell(buffer) + len > buffer->packet->tot_len) {
+        return false;
+    }
+
+    buffer->currentPosition += len;
+    while (buffer->currentPosition > buffer->bufList->len) {
+        if (!mdns_advance_buffer(buffer)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+// contiguous bytes at the read position
+const uint8_t *mdns_stream_peek_span(mdnsStreamBuf *buffer, uint16_t *len) {
+    if (!mdns_normalize_buffer(buffer)) {
+        *len = 0;
+        return NULL;
+    }
+    *len = buffer->bufList->len - buffer->currentPosition;
+    return (uint8_t *)buffer->bufList->payload + buffer->currentPosition;
+}
+
+// offset of the read position from the start of the packet
+uint16_t mdns_stream_tell(mdnsStreamBuf *buffer) {
+    return buffer->bufferOffset + buffer->currentPosition;
+}
+
+// move read position to offset from the start of the packet
+bool mdns_stream_seek(mdnsStreamBuf *buffer, uint16_t offset) {
+    if (offset > buffer->packet->tot_len) {
+        return false;
+    }
+
+    // rewind if the offset is before the current pbuf
+    if (offset < buffer->bufferOffset) {
+        buffer->bufList = buffer->packet;
+        buffer->bufferOffset = 0;
+    }
+
+    buffer->currentPosition = offset - buffer->bufferOffset;
+    while (buffer->currentPosition > buffer->bufList->len) {
+        if (!mdns_advance_buffer(buffer)) {
+            break;
+        }
+    }
+
+    return true;
 }